@@ -0,0 +1,129 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "alloc-stats.h"
+
+// The allocator is wrapped through the glibc internal entry points, and
+// mmap through the raw syscall, so that no lookup is needed before the
+// first allocation.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+enum alloc_counter {
+	ALLOC_MALLOC,
+	ALLOC_FREE,
+	ALLOC_MMAP,
+	ALLOC_MUNMAP,
+	ALLOC_COUNTER_COUNT,
+};
+
+static const char *counter_names[] = {
+	[ALLOC_MALLOC] = "malloc",
+	[ALLOC_FREE] = "free",
+	[ALLOC_MMAP] = "mmap",
+	[ALLOC_MUNMAP] = "munmap",
+};
+
+static uint64_t counters[ALLOC_COUNTER_COUNT];
+
+static struct {
+	uint64_t last[ALLOC_COUNTER_COUNT];
+	uint64_t total[ALLOC_COUNTER_COUNT];
+	uint64_t max[ALLOC_COUNTER_COUNT];
+	uint64_t frames, warmup_frames;
+} stats;
+
+static void count(enum alloc_counter counter) {
+	// render threads allocate too
+	__atomic_fetch_add(&counters[counter], 1, __ATOMIC_RELAXED);
+}
+
+void *malloc(size_t size) {
+	count(ALLOC_MALLOC);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+	count(ALLOC_MALLOC);
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+	count(ALLOC_MALLOC);
+	return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+	count(ALLOC_MALLOC);
+	void *ptr = __libc_memalign(alignment, size);
+	if (ptr == NULL) {
+		return ENOMEM;
+	}
+	*memptr = ptr;
+	return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+	count(ALLOC_MALLOC);
+	return __libc_memalign(alignment, size);
+}
+
+void free(void *ptr) {
+	if (ptr != NULL) {
+		count(ALLOC_FREE);
+	}
+	__libc_free(ptr);
+}
+
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t off) {
+	count(ALLOC_MMAP);
+	return (void *)syscall(SYS_mmap, addr, len, prot, flags, fd, off);
+}
+
+int munmap(void *addr, size_t len) {
+	count(ALLOC_MUNMAP);
+	return syscall(SYS_munmap, addr, len);
+}
+
+// Called after each frame is committed. Frames flagged as warmup, such as
+// the first one of each output, are left out of the totals.
+void alloc_stats_frame(bool warmup) {
+	for (size_t i = 0; i < ALLOC_COUNTER_COUNT; i++) {
+		uint64_t value = __atomic_load_n(&counters[i], __ATOMIC_RELAXED);
+		uint64_t delta = value - stats.last[i];
+		stats.last[i] = value;
+		if (warmup) {
+			continue;
+		}
+		stats.total[i] += delta;
+		if (delta > stats.max[i]) {
+			stats.max[i] = delta;
+		}
+	}
+	if (warmup) {
+		stats.warmup_frames++;
+	} else {
+		stats.frames++;
+	}
+}
+
+void alloc_stats_print(FILE *f) {
+	fprintf(f, "alloc-stats: %llu frames, %llu warmup frames\n",
+		(unsigned long long)stats.frames,
+		(unsigned long long)stats.warmup_frames);
+	for (size_t i = 0; i < ALLOC_COUNTER_COUNT; i++) {
+		fprintf(f, "alloc-stats: %-6s total %llu, max %llu per frame\n",
+			counter_names[i], (unsigned long long)stats.total[i],
+			(unsigned long long)stats.max[i]);
+	}
+}
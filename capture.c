@@ -0,0 +1,375 @@
+#include <cairo/cairo.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wlr-screencopy-unstable-v1-client-protocol.h"
+
+#include "capture.h"
+#include "pool-buffer.h"
+#include "slurp.h"
+
+struct capture_frame {
+	struct slurp_state *state;
+	struct slurp_output *output;
+	struct zwlr_screencopy_frame_v1 *frame;
+	struct slurp_box region; // layout coordinates
+	struct pool_buffer *buffer;
+	// used when the compositor still holds both overlay buffers
+	struct pool_buffer own_buffer;
+	uint32_t flags;
+	bool done, failed;
+};
+
+static int max(int a, int b) {
+	return (a > b) ? a : b;
+}
+
+static int min(int a, int b) {
+	return (a < b) ? a : b;
+}
+
+static void frame_handle_buffer(void *data,
+		struct zwlr_screencopy_frame_v1 *frame, uint32_t format,
+		uint32_t width, uint32_t height, uint32_t stride) {
+	struct capture_frame *capture = data;
+	switch (format) {
+	case WL_SHM_FORMAT_ARGB8888:
+	case WL_SHM_FORMAT_XRGB8888:
+	case WL_SHM_FORMAT_ABGR8888:
+	case WL_SHM_FORMAT_XBGR8888:
+		break;
+	default:
+		fprintf(stderr, "unsupported screencopy format 0x%08x\n", format);
+		capture->failed = capture->done = true;
+		return;
+	}
+
+	// the overlay is gone, its buffers can hold the capture once the
+	// compositor has released them
+	struct wl_shm *shm = capture->state->shm;
+	capture->buffer = get_next_buffer_format(shm, capture->output->buffers,
+		width, height, stride, format);
+	if (capture->buffer == NULL) {
+		capture->buffer = get_buffer_format(shm, &capture->own_buffer,
+			width, height, stride, format);
+	}
+	if (capture->buffer == NULL) {
+		fprintf(stderr, "failed to create capture buffer\n");
+		capture->failed = capture->done = true;
+		return;
+	}
+	zwlr_screencopy_frame_v1_copy(frame, capture->buffer->buffer);
+}
+
+static void frame_handle_flags(void *data,
+		struct zwlr_screencopy_frame_v1 *frame, uint32_t flags) {
+	struct capture_frame *capture = data;
+	capture->flags = flags;
+}
+
+static void frame_handle_ready(void *data,
+		struct zwlr_screencopy_frame_v1 *frame, uint32_t tv_sec_hi,
+		uint32_t tv_sec_lo, uint32_t tv_nsec) {
+	struct capture_frame *capture = data;
+	capture->done = true;
+}
+
+static void frame_handle_failed(void *data,
+		struct zwlr_screencopy_frame_v1 *frame) {
+	struct capture_frame *capture = data;
+	capture->failed = capture->done = true;
+}
+
+static const struct zwlr_screencopy_frame_v1_listener frame_listener = {
+	.buffer = frame_handle_buffer,
+	.flags = frame_handle_flags,
+	.ready = frame_handle_ready,
+	.failed = frame_handle_failed,
+};
+
+static void composite_frame(cairo_t *cairo, struct capture_frame *capture,
+		const struct slurp_box *result, int32_t scale) {
+	struct pool_buffer *buffer = capture->buffer;
+	uint32_t *pixels = buffer->data;
+
+	if (buffer->format == WL_SHM_FORMAT_ABGR8888 ||
+			buffer->format == WL_SHM_FORMAT_XBGR8888) {
+		for (uint32_t y = 0; y < buffer->height; y++) {
+			uint32_t *row = pixels + y * (buffer->stride / sizeof(*row));
+			for (uint32_t x = 0; x < buffer->width; x++) {
+				uint32_t p = row[x];
+				row[x] = (p & 0xFF00FF00) | (p & 0xFF) << 16 |
+					(p >> 16 & 0xFF);
+			}
+		}
+	}
+
+	cairo_surface_t *surface = cairo_image_surface_create_for_data(
+		buffer->data, CAIRO_FORMAT_RGB24, buffer->width, buffer->height,
+		buffer->stride);
+
+	cairo_save(cairo);
+	cairo_translate(cairo, (capture->region.x - result->x) * scale,
+		(capture->region.y - result->y) * scale);
+	cairo_scale(cairo, (double)capture->region.width * scale / buffer->width,
+		(double)capture->region.height * scale / buffer->height);
+	if (capture->flags & ZWLR_SCREENCOPY_FRAME_V1_FLAGS_Y_INVERT) {
+		cairo_translate(cairo, 0, buffer->height);
+		cairo_scale(cairo, 1, -1);
+	}
+	cairo_set_source_surface(cairo, surface, 0, 0);
+	cairo_rectangle(cairo, 0, 0, buffer->width, buffer->height);
+	cairo_fill(cairo);
+	cairo_restore(cairo);
+
+	cairo_surface_destroy(surface);
+}
+
+struct image_writer {
+	unsigned char *data;
+	size_t len, cap;
+	bool failed;
+};
+
+static void writer_append(struct image_writer *writer, const void *data,
+		size_t len) {
+	if (writer->len + len > writer->cap) {
+		size_t cap = writer->cap ? writer->cap : 4096;
+		while (cap < writer->len + len) {
+			cap *= 2;
+		}
+		unsigned char *buf = realloc(writer->data, cap);
+		if (buf == NULL) {
+			writer->failed = true;
+			return;
+		}
+		writer->data = buf;
+		writer->cap = cap;
+	}
+	memcpy(writer->data + writer->len, data, len);
+	writer->len += len;
+}
+
+static void writer_append_u8(struct image_writer *writer, uint8_t v) {
+	writer_append(writer, &v, 1);
+}
+
+static void writer_append_u32_be(struct image_writer *writer, uint32_t v) {
+	uint8_t bytes[4] = { v >> 24, v >> 16, v >> 8, v };
+	writer_append(writer, bytes, sizeof(bytes));
+}
+
+static cairo_status_t writer_write_png(void *closure, const unsigned char *data,
+		unsigned int len) {
+	struct image_writer *writer = closure;
+	writer_append(writer, data, len);
+	return writer->failed ? CAIRO_STATUS_WRITE_ERROR : CAIRO_STATUS_SUCCESS;
+}
+
+static void encode_ppm(struct image_writer *writer, cairo_surface_t *surface) {
+	int width = cairo_image_surface_get_width(surface);
+	int height = cairo_image_surface_get_height(surface);
+	int stride = cairo_image_surface_get_stride(surface);
+	unsigned char *data = cairo_image_surface_get_data(surface);
+
+	char header[64];
+	int len = snprintf(header, sizeof(header), "P6\n%d %d\n255\n",
+		width, height);
+	writer_append(writer, header, len);
+
+	unsigned char *row = malloc(3 * width);
+	if (row == NULL) {
+		writer->failed = true;
+		return;
+	}
+	for (int y = 0; y < height; y++) {
+		const uint32_t *pixels = (const uint32_t *)(data + y * stride);
+		for (int x = 0; x < width; x++) {
+			row[3 * x + 0] = pixels[x] >> 16 & 0xFF;
+			row[3 * x + 1] = pixels[x] >> 8 & 0xFF;
+			row[3 * x + 2] = pixels[x] & 0xFF;
+		}
+		writer_append(writer, row, 3 * width);
+	}
+	free(row);
+}
+
+static void encode_qoi(struct image_writer *writer, cairo_surface_t *surface) {
+	int width = cairo_image_surface_get_width(surface);
+	int height = cairo_image_surface_get_height(surface);
+	int stride = cairo_image_surface_get_stride(surface);
+	unsigned char *data = cairo_image_surface_get_data(surface);
+
+	writer_append(writer, "qoif", 4);
+	writer_append_u32_be(writer, width);
+	writer_append_u32_be(writer, height);
+	writer_append_u8(writer, 3); // RGB
+	writer_append_u8(writer, 0); // sRGB with linear alpha
+
+	// pixels are opaque, so only the RGB part of the ops is needed
+	uint32_t index[64] = {0};
+	uint32_t prev = 0xFF000000;
+	int run = 0;
+	for (int y = 0; y < height; y++) {
+		const uint32_t *pixels = (const uint32_t *)(data + y * stride);
+		for (int x = 0; x < width; x++) {
+			uint32_t px = pixels[x] | 0xFF000000;
+			bool last = y == height - 1 && x == width - 1;
+			if (px == prev) {
+				run++;
+				if (run == 62 || last) {
+					writer_append_u8(writer, 0xC0 | (run - 1));
+					run = 0;
+				}
+				continue;
+			}
+			if (run > 0) {
+				writer_append_u8(writer, 0xC0 | (run - 1));
+				run = 0;
+			}
+
+			uint8_t r = px >> 16, g = px >> 8, b = px;
+			int hash = (r * 3 + g * 5 + b * 7 + 255 * 11) % 64;
+			if (index[hash] == px) {
+				writer_append_u8(writer, hash);
+			} else {
+				index[hash] = px;
+				int8_t dr = r - (uint8_t)(prev >> 16);
+				int8_t dg = g - (uint8_t)(prev >> 8);
+				int8_t db = b - (uint8_t)prev;
+				int8_t dr_dg = dr - dg;
+				int8_t db_dg = db - dg;
+				if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 &&
+						db >= -2 && db <= 1) {
+					writer_append_u8(writer, 0x40 | (dr + 2) << 4 |
+						(dg + 2) << 2 | (db + 2));
+				} else if (dg >= -32 && dg <= 31 && dr_dg >= -8 &&
+						dr_dg <= 7 && db_dg >= -8 && db_dg <= 7) {
+					writer_append_u8(writer, 0x80 | (dg + 32));
+					writer_append_u8(writer, (dr_dg + 8) << 4 | (db_dg + 8));
+				} else {
+					uint8_t rgb[4] = { 0xFE, r, g, b };
+					writer_append(writer, rgb, sizeof(rgb));
+				}
+			}
+			prev = px;
+		}
+	}
+
+	static const uint8_t end[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+	writer_append(writer, end, sizeof(end));
+}
+
+int slurp_capture(struct slurp_state *state, enum capture_format format,
+		FILE *stream) {
+	if (state->screencopy_manager == NULL) {
+		state->error = "compositor doesn't support zwlr_screencopy_manager_v1";
+		return EXIT_FAILURE;
+	}
+
+	// Make sure the overlay isn't part of the capture
+	slurp_unmap(state);
+
+	const struct slurp_box *result = &state->result;
+	size_t n_frames = wl_list_length(&state->outputs);
+	struct capture_frame *frames = calloc(n_frames, sizeof(*frames));
+	if (frames == NULL) {
+		state->error = "allocation failed";
+		return EXIT_FAILURE;
+	}
+
+	int32_t scale = 1;
+	size_t n = 0;
+	struct slurp_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		struct slurp_box *geometry = &output->logical_geometry;
+		if (!slurp_box_intersect(geometry, result)) {
+			continue;
+		}
+
+		struct capture_frame *capture = &frames[n++];
+		capture->state = state;
+		capture->output = output;
+		capture->region.x = max(geometry->x, result->x);
+		capture->region.y = max(geometry->y, result->y);
+		capture->region.width = min(geometry->x + geometry->width,
+			result->x + result->width) - capture->region.x;
+		capture->region.height = min(geometry->y + geometry->height,
+			result->y + result->height) - capture->region.y;
+		scale = max(scale, output->scale);
+
+		capture->frame = zwlr_screencopy_manager_v1_capture_output_region(
+			state->screencopy_manager, false, output->wl_output,
+			capture->region.x - geometry->x, capture->region.y - geometry->y,
+			capture->region.width, capture->region.height);
+		zwlr_screencopy_frame_v1_add_listener(capture->frame,
+			&frame_listener, capture);
+	}
+	if (n == 0) {
+		free(frames);
+		state->error = "selection doesn't intersect any output";
+		return EXIT_FAILURE;
+	}
+
+	bool done = false;
+	while (!done && wl_display_dispatch(state->display) != -1) {
+		done = true;
+		for (size_t i = 0; i < n; i++) {
+			done = done && frames[i].done;
+		}
+	}
+
+	int status = EXIT_SUCCESS;
+	cairo_surface_t *image = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+		result->width * scale, result->height * scale);
+	cairo_t *cairo = cairo_create(image);
+	cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
+	cairo_set_source_rgb(cairo, 0, 0, 0);
+	cairo_paint(cairo);
+	for (size_t i = 0; i < n; i++) {
+		if (!frames[i].done || frames[i].failed) {
+			state->error = "failed to capture output";
+			status = EXIT_FAILURE;
+		} else {
+			composite_frame(cairo, &frames[i], result, scale);
+		}
+		zwlr_screencopy_frame_v1_destroy(frames[i].frame);
+		finish_buffer(&frames[i].own_buffer);
+	}
+	cairo_destroy(cairo);
+	free(frames);
+
+	if (status == EXIT_SUCCESS) {
+		cairo_surface_flush(image);
+		struct image_writer writer = {0};
+		switch (format) {
+		case CAPTURE_FORMAT_PPM:
+			encode_ppm(&writer, image);
+			break;
+		case CAPTURE_FORMAT_PNG:
+			if (cairo_surface_write_to_png_stream(image, writer_write_png,
+					&writer) != CAIRO_STATUS_SUCCESS) {
+				writer.failed = true;
+			}
+			break;
+		case CAPTURE_FORMAT_QOI:
+			encode_qoi(&writer, image);
+			break;
+		}
+		if (writer.failed) {
+			state->error = "failed to encode capture";
+			status = EXIT_FAILURE;
+		} else if (fwrite(writer.data, 1, writer.len, stream) != writer.len ||
+				fflush(stream) != 0) {
+			state->error = "failed to write capture";
+			status = EXIT_FAILURE;
+		}
+		free(writer.data);
+	}
+	cairo_surface_destroy(image);
+
+	return status;
+}
@@ -0,0 +1,223 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "control.h"
+#include "slurp.h"
+
+bool control_init(struct slurp_control *control, int fd) {
+	*control = (struct slurp_control){
+		.fd = fd,
+	};
+	control->fd_flags = fcntl(fd, F_GETFL);
+	if (control->fd_flags == -1) {
+		return false;
+	}
+	return fcntl(fd, F_SETFL, control->fd_flags | O_NONBLOCK) != -1;
+}
+
+static size_t table_slot(const struct slurp_control *control, uint32_t id) {
+	uint32_t h = id * 0x9E3779B1u;
+	return (h ^ (h >> 16)) & (control->cap - 1);
+}
+
+// index of the box with the id, or of the empty slot ending its probe
+static size_t table_find(const struct slurp_control *control, uint32_t id) {
+	size_t mask = control->cap - 1;
+	size_t i = table_slot(control, id);
+	while (control->table[i] != NULL && control->table[i]->id != id) {
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+static struct slurp_box *table_get(const struct slurp_control *control,
+		uint32_t id) {
+	if (control->cap == 0) {
+		return NULL;
+	}
+	return control->table[table_find(control, id)];
+}
+
+static bool table_insert(struct slurp_control *control, struct slurp_box *box) {
+	// keep the load factor at most 1/2
+	if ((control->len + 1) * 2 > control->cap) {
+		size_t cap = control->cap ? control->cap * 2 : 64;
+		struct slurp_box **table = calloc(cap, sizeof(*table));
+		if (table == NULL) {
+			fprintf(stderr, "allocation failed\n");
+			return false;
+		}
+		struct slurp_box **old = control->table;
+		size_t old_cap = control->cap;
+		control->table = table;
+		control->cap = cap;
+		for (size_t i = 0; i < old_cap; i++) {
+			if (old[i] != NULL) {
+				control->table[table_find(control, old[i]->id)] = old[i];
+			}
+		}
+		free(old);
+	}
+	control->table[table_find(control, box->id)] = box;
+	control->len++;
+	return true;
+}
+
+void control_forget(struct slurp_control *control,
+		const struct slurp_box *box) {
+	if (control->cap == 0) {
+		return;
+	}
+	size_t mask = control->cap - 1;
+	size_t i = table_find(control, box->id);
+	if (control->table[i] != box) {
+		return;
+	}
+	control->len--;
+	// shift the following entries of the probe back, so that no lookup
+	// stops early at the hole
+	size_t j = i;
+	while (true) {
+		j = (j + 1) & mask;
+		if (control->table[j] == NULL) {
+			break;
+		}
+		size_t k = table_slot(control, control->table[j]->id);
+		bool in_place = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+		if (!in_place) {
+			control->table[i] = control->table[j];
+			i = j;
+		}
+	}
+	control->table[i] = NULL;
+}
+
+static bool parse_geometry(const char *str, struct slurp_box *box,
+		char **label) {
+	int n;
+	if (label != NULL) {
+		n = sscanf(str, " %d,%d %dx%d %m[^\n]", &box->x, &box->y,
+			&box->width, &box->height, label);
+	} else {
+		char end;
+		n = sscanf(str, " %d,%d %dx%d %c", &box->x, &box->y,
+			&box->width, &box->height, &end);
+	}
+	return n == 4 + (label != NULL && *label != NULL) &&
+		box->width > 0 && box->height > 0;
+}
+
+static void control_line(struct slurp_control *control,
+		struct slurp_state *state, const char *line) {
+	char cmd[8];
+	uint32_t id;
+	int n = 0;
+	if (sscanf(line, "%7s %" SCNu32 "%n", cmd, &id, &n) != 2 || id == 0) {
+		goto invalid;
+	}
+	const char *args = line + n;
+	struct slurp_box *box = table_get(control, id);
+
+	if (strcmp(cmd, "add") == 0) {
+		struct slurp_box geometry = { .id = id };
+		if (!parse_geometry(args, &geometry, &geometry.label)) {
+			free(geometry.label);
+			goto invalid;
+		}
+		if (box != NULL) {
+			fprintf(stderr, "control: box %" PRIu32 " already exists\n", id);
+			free(geometry.label);
+			return;
+		}
+		box = slurp_add_choice_box(state, &geometry);
+		free(geometry.label);
+		if (box != NULL && !table_insert(control, box)) {
+			slurp_remove_choice_box(state, box);
+		}
+	} else if (strcmp(cmd, "move") == 0) {
+		struct slurp_box geometry = {0};
+		if (!parse_geometry(args, &geometry, NULL)) {
+			goto invalid;
+		}
+		if (box != NULL) {
+			slurp_move_choice_box(state, box, &geometry);
+		}
+	} else if (strcmp(cmd, "remove") == 0) {
+		if (args[strspn(args, " \t")] != '\0') {
+			goto invalid;
+		}
+		if (box != NULL) {
+			slurp_remove_choice_box(state, box);
+		}
+	} else {
+		goto invalid;
+	}
+	return;
+
+invalid:
+	fprintf(stderr, "control: invalid command: %s\n", line);
+}
+
+// Reads once per call, so a busy writer can't hold up the event loop
+void control_read(struct slurp_control *control, struct slurp_state *state) {
+	ssize_t n;
+	do {
+		// keep a byte free for the terminator
+		n = read(control->fd, control->buf + control->buf_len,
+			sizeof(control->buf) - 1 - control->buf_len);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+		return;
+	}
+	if (n <= 0) {
+		if (n < 0) {
+			fprintf(stderr, "control: read failed: %s\n", strerror(errno));
+		}
+		control->eof = true;
+		// the last line may lack its newline
+		if (control->buf_len > 0 && !control->overflow) {
+			control->buf[control->buf_len] = '\0';
+			control_line(control, state, control->buf);
+		}
+		control->buf_len = 0;
+		return;
+	}
+
+	size_t len = control->buf_len + n, start = 0;
+	for (size_t i = control->buf_len; i < len; i++) {
+		if (control->buf[i] != '\n') {
+			continue;
+		}
+		control->buf[i] = '\0';
+		if (!control->overflow) {
+			control_line(control, state, &control->buf[start]);
+		}
+		control->overflow = false;
+		start = i + 1;
+	}
+	control->buf_len = len - start;
+	memmove(control->buf, &control->buf[start], control->buf_len);
+
+	if (control->buf_len == sizeof(control->buf) - 1 ||
+			(control->overflow && control->buf_len > 0)) {
+		if (!control->overflow) {
+			fprintf(stderr, "control: line too long\n");
+		}
+		control->overflow = true;
+		control->buf_len = 0;
+	}
+}
+
+void control_finish(struct slurp_control *control) {
+	fcntl(control->fd, F_SETFL, control->fd_flags);
+	free(control->table);
+	control->table = NULL;
+	control->len = control->cap = 0;
+}
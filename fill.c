@@ -0,0 +1,143 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+#include "fill.h"
+
+// Everything render() draws is an axis-aligned rectangle painted with
+// CAIRO_OPERATOR_SOURCE, so it boils down to storing one pixel value over
+// a number of spans. These kernels do that directly on the buffer memory.
+
+typedef void (*fill_span_func)(uint32_t *dst, size_t len, uint32_t color);
+
+static void fill_span_scalar(uint32_t *dst, size_t len, uint32_t color) {
+	for (size_t i = 0; i < len; i++) {
+		dst[i] = color;
+	}
+}
+
+#ifdef HAVE_X86_KERNELS
+__attribute__((target("sse2")))
+static void fill_span_sse2(uint32_t *dst, size_t len, uint32_t color) {
+	__m128i v = _mm_set1_epi32((int32_t)color);
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16) {
+		_mm_storeu_si128((__m128i *)(dst + i), v);
+		_mm_storeu_si128((__m128i *)(dst + i + 4), v);
+		_mm_storeu_si128((__m128i *)(dst + i + 8), v);
+		_mm_storeu_si128((__m128i *)(dst + i + 12), v);
+	}
+	for (; i + 4 <= len; i += 4) {
+		_mm_storeu_si128((__m128i *)(dst + i), v);
+	}
+	fill_span_scalar(dst + i, len - i, color);
+}
+
+__attribute__((target("avx2")))
+static void fill_span_avx2(uint32_t *dst, size_t len, uint32_t color) {
+	__m256i v = _mm256_set1_epi32((int32_t)color);
+	size_t i = 0;
+	for (; i + 32 <= len; i += 32) {
+		_mm256_storeu_si256((__m256i *)(dst + i), v);
+		_mm256_storeu_si256((__m256i *)(dst + i + 8), v);
+		_mm256_storeu_si256((__m256i *)(dst + i + 16), v);
+		_mm256_storeu_si256((__m256i *)(dst + i + 24), v);
+	}
+	for (; i + 8 <= len; i += 8) {
+		_mm256_storeu_si256((__m256i *)(dst + i), v);
+	}
+	fill_span_scalar(dst + i, len - i, color);
+}
+#endif
+
+static fill_span_func fill_span = fill_span_scalar;
+
+void fill_init(void) {
+#ifdef HAVE_X86_KERNELS
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		fill_span = fill_span_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		fill_span = fill_span_sse2;
+	}
+#endif
+}
+
+static uint32_t premultiply(uint32_t channel, uint32_t alpha) {
+	uint32_t v = channel * alpha + 128;
+	return (v + (v >> 8)) >> 8;
+}
+
+uint32_t fill_color_from_rgba(uint32_t color) {
+	uint32_t r = color >> (3 * 8) & 0xFF;
+	uint32_t g = color >> (2 * 8) & 0xFF;
+	uint32_t b = color >> (1 * 8) & 0xFF;
+	uint32_t a = color >> (0 * 8) & 0xFF;
+	return a << 24 | premultiply(r, a) << 16 | premultiply(g, a) << 8 |
+		premultiply(b, a);
+}
+
+size_t fill_rect(const struct fill_target *target, int32_t x, int32_t y,
+		int32_t width, int32_t height, uint32_t color) {
+	int32_t x1 = x + width;
+	int32_t y1 = y + height;
+	if (x < 0) {
+		x = 0;
+	}
+	if (y < 0) {
+		y = 0;
+	}
+	if (x1 > target->width) {
+		x1 = target->width;
+	}
+	if (y1 > target->height) {
+		y1 = target->height;
+	}
+	if (x >= x1 || y >= y1) {
+		return 0;
+	}
+	size_t pixels = (size_t)(y1 - y) * (x1 - x);
+
+	uint32_t *row = target->data + (size_t)y * target->stride + x;
+	if (x == 0 && x1 == target->width && target->stride == target->width) {
+		// Contiguous rows, fill them as a single span
+		fill_span(row, pixels, color);
+		return pixels;
+	}
+	for (int32_t i = y; i < y1; i++) {
+		fill_span(row, x1 - x, color);
+		row += target->stride;
+	}
+	return pixels;
+}
+
+size_t fill_border(const struct fill_target *target, int32_t x, int32_t y,
+		int32_t width, int32_t height, int32_t weight, uint32_t color) {
+	if (weight <= 0) {
+		return 0;
+	}
+
+	// Like a cairo stroke, the border is centered on the rectangle's edges
+	int32_t outside = weight / 2;
+	int32_t x0 = x - outside;
+	int32_t y0 = y - outside;
+	int32_t outer_width = width + weight;
+	int32_t outer_height = height + weight;
+
+	if (outer_width <= 2 * weight || outer_height <= 2 * weight) {
+		return fill_rect(target, x0, y0, outer_width, outer_height, color);
+	}
+
+	int32_t inner_height = outer_height - 2 * weight;
+	size_t pixels = fill_rect(target, x0, y0, outer_width, weight, color);
+	pixels += fill_rect(target, x0, y0 + outer_height - weight, outer_width,
+		weight, color);
+	pixels += fill_rect(target, x0, y0 + weight, weight, inner_height, color);
+	pixels += fill_rect(target, x0 + outer_width - weight, y0 + weight, weight,
+		inner_height, color);
+	return pixels;
+}
@@ -0,0 +1,263 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "format.h"
+#include "output-index.h"
+#include "slurp.h"
+
+static int min(int a, int b) {
+	return (a < b) ? a : b;
+}
+
+static enum format_token_type token_type_from_char(char c) {
+	switch (c) {
+	case 'x':
+		return FORMAT_TOKEN_X;
+	case 'y':
+		return FORMAT_TOKEN_Y;
+	case 'w':
+		return FORMAT_TOKEN_WIDTH;
+	case 'h':
+		return FORMAT_TOKEN_HEIGHT;
+	case 'X':
+		return FORMAT_TOKEN_OUTPUT_X;
+	case 'Y':
+		return FORMAT_TOKEN_OUTPUT_Y;
+	case 'W':
+		return FORMAT_TOKEN_OUTPUT_WIDTH;
+	case 'H':
+		return FORMAT_TOKEN_OUTPUT_HEIGHT;
+	case 'l':
+		return FORMAT_TOKEN_LABEL;
+	case 'o':
+		return FORMAT_TOKEN_OUTPUT_NAME;
+	default:
+		return FORMAT_TOKEN_LITERAL;
+	}
+}
+
+static bool push_token(struct format *format, enum format_token_type type,
+		const char *text, size_t len) {
+	// merge adjacent literals
+	if (type == FORMAT_TOKEN_LITERAL && format->len > 0) {
+		struct format_token *last = &format->tokens[format->len - 1];
+		if (last->type == FORMAT_TOKEN_LITERAL &&
+				last->text + last->len == text) {
+			last->len += len;
+			return true;
+		}
+	}
+
+	struct format_token *tokens = realloc(format->tokens,
+		(format->len + 1) * sizeof(*tokens));
+	if (tokens == NULL) {
+		return false;
+	}
+	format->tokens = tokens;
+	format->tokens[format->len++] = (struct format_token){
+		.type = type,
+		.text = text,
+		.len = len,
+	};
+	return true;
+}
+
+bool format_compile(struct format *format, const char *str) {
+	*format = (struct format){0};
+	for (size_t i = 0; str[i] != '\0'; i++) {
+		enum format_token_type type = FORMAT_TOKEN_LITERAL;
+		if (str[i] == '%') {
+			type = token_type_from_char(str[i + 1]);
+		}
+
+		bool ok;
+		if (type == FORMAT_TOKEN_LITERAL) {
+			ok = push_token(format, type, &str[i], 1);
+		} else {
+			i++; // Skip the next character (x, y, w or h)
+			ok = push_token(format, type, NULL, 0);
+		}
+		if (!ok) {
+			format_finish(format);
+			return false;
+		}
+	}
+	return true;
+}
+
+void format_init_json(struct format *format) {
+	*format = (struct format){ .json = true };
+}
+
+static bool reserve(struct format *format, size_t len) {
+	if (format->buf_len + len <= format->buf_cap) {
+		return true;
+	}
+	size_t cap = format->buf_cap ? format->buf_cap : 64;
+	while (cap < format->buf_len + len) {
+		cap *= 2;
+	}
+	char *buf = realloc(format->buf, cap);
+	if (buf == NULL) {
+		return false;
+	}
+	format->buf = buf;
+	format->buf_cap = cap;
+	return true;
+}
+
+static void append(struct format *format, const char *text, size_t len) {
+	if (!reserve(format, len)) {
+		return;
+	}
+	memcpy(format->buf + format->buf_len, text, len);
+	format->buf_len += len;
+}
+
+static void append_str(struct format *format, const char *text) {
+	append(format, text, strlen(text));
+}
+
+static void append_int(struct format *format, int32_t value) {
+	char str[12];
+	int len = snprintf(str, sizeof(str), "%" PRId32, value);
+	append(format, str, len);
+}
+
+static void append_json_str(struct format *format, const char *text) {
+	if (text == NULL) {
+		append_str(format, "null");
+		return;
+	}
+	append_str(format, "\"");
+	for (const char *c = text; *c != '\0'; c++) {
+		switch (*c) {
+		case '"':
+			append_str(format, "\\\"");
+			break;
+		case '\\':
+			append_str(format, "\\\\");
+			break;
+		case '\n':
+			append_str(format, "\\n");
+			break;
+		case '\t':
+			append_str(format, "\\t");
+			break;
+		default:
+			if ((unsigned char)*c < 0x20) {
+				char escaped[7];
+				snprintf(escaped, sizeof(escaped), "\\u%04x", *c);
+				append_str(format, escaped);
+			} else {
+				append(format, c, 1);
+			}
+		}
+	}
+	append_str(format, "\"");
+}
+
+static void render_json(struct format *format, const struct slurp_box *result,
+		struct slurp_output *output) {
+	append_str(format, "{\"x\":");
+	append_int(format, result->x);
+	append_str(format, ",\"y\":");
+	append_int(format, result->y);
+	append_str(format, ",\"width\":");
+	append_int(format, result->width);
+	append_str(format, ",\"height\":");
+	append_int(format, result->height);
+	append_str(format, ",\"label\":");
+	append_json_str(format, result->label);
+	append_str(format, ",\"output\":");
+	if (output == NULL) {
+		append_str(format, "null}\n");
+		return;
+	}
+	const struct slurp_box *geometry = &output->logical_geometry;
+	append_str(format, "{\"name\":");
+	append_json_str(format, geometry->label);
+	append_str(format, ",\"x\":");
+	append_int(format, result->x - geometry->x);
+	append_str(format, ",\"y\":");
+	append_int(format, result->y - geometry->y);
+	append_str(format, ",\"width\":");
+	append_int(format, min(result->width,
+		geometry->x + geometry->width - result->x));
+	append_str(format, ",\"height\":");
+	append_int(format, min(result->height,
+		geometry->y + geometry->height - result->y));
+	append_str(format, "}}\n");
+}
+
+const char *format_render(struct format *format, struct slurp_state *state,
+		const struct slurp_box *result, size_t *len) {
+	struct slurp_output *output = output_index_from_box(state, result);
+	format->buf_len = 0;
+
+	if (format->json) {
+		render_json(format, result, output);
+		*len = format->buf_len;
+		return format->buf;
+	}
+
+	for (size_t i = 0; i < format->len; i++) {
+		const struct format_token *token = &format->tokens[i];
+		switch (token->type) {
+		case FORMAT_TOKEN_LITERAL:
+			append(format, token->text, token->len);
+			break;
+		case FORMAT_TOKEN_X:
+			append_int(format, result->x);
+			break;
+		case FORMAT_TOKEN_Y:
+			append_int(format, result->y);
+			break;
+		case FORMAT_TOKEN_WIDTH:
+			append_int(format, result->width);
+			break;
+		case FORMAT_TOKEN_HEIGHT:
+			append_int(format, result->height);
+			break;
+		case FORMAT_TOKEN_OUTPUT_X:
+			assert(output);
+			append_int(format, result->x - output->logical_geometry.x);
+			break;
+		case FORMAT_TOKEN_OUTPUT_Y:
+			assert(output);
+			append_int(format, result->y - output->logical_geometry.y);
+			break;
+		case FORMAT_TOKEN_OUTPUT_WIDTH:
+			assert(output);
+			append_int(format, min(result->width, output->logical_geometry.x + output->logical_geometry.width - result->x));
+			break;
+		case FORMAT_TOKEN_OUTPUT_HEIGHT:
+			assert(output);
+			append_int(format, min(result->height, output->logical_geometry.y + output->logical_geometry.height - result->y));
+			break;
+		case FORMAT_TOKEN_LABEL:
+			if (result->label) {
+				append_str(format, result->label);
+			}
+			break;
+		case FORMAT_TOKEN_OUTPUT_NAME:
+			if (output && output->logical_geometry.label) {
+				append_str(format, output->logical_geometry.label);
+			} else {
+				append_str(format, "<unknown>");
+			}
+			break;
+		}
+	}
+	*len = format->buf_len;
+	return format->buf;
+}
+
+void format_finish(struct format *format) {
+	free(format->tokens);
+	free(format->buf);
+	*format = (struct format){0};
+}
@@ -0,0 +1,160 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <time.h>
+
+#include "frame-stats.h"
+#include "slurp.h"
+
+// Render times are kept in a log-linear histogram: 8 buckets per power of
+// two, so percentiles are within 12.5% without storing every sample.
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_SUB (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_LEN (HISTOGRAM_SUB + (64 - HISTOGRAM_SUB_BITS) * HISTOGRAM_SUB)
+
+bool frame_stats_enabled = false;
+
+static struct {
+	uint64_t frames, dropped;
+	uint64_t render_ns[HISTOGRAM_LEN];
+	uint64_t render_max_ns;
+	uint64_t pixels;
+	uint64_t buffers_created, pools_created;
+	uint64_t shm_mapped, shm_peak;
+	uint64_t buffers_reclaimed;
+	uint64_t motion_events;
+} stats;
+
+void frame_stats_enable(void) {
+	frame_stats_enabled = true;
+}
+
+uint64_t frame_stats_now(void) {
+	if (!frame_stats_enabled) {
+		return 0;
+	}
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static size_t histogram_index(uint64_t v) {
+	if (v < HISTOGRAM_SUB) {
+		return v;
+	}
+	int e = 63 - __builtin_clzll(v);
+	int shift = e - HISTOGRAM_SUB_BITS;
+	return HISTOGRAM_SUB + shift * HISTOGRAM_SUB +
+		((v >> shift) & (HISTOGRAM_SUB - 1));
+}
+
+// largest value that falls into the bucket
+static uint64_t histogram_value(size_t i) {
+	if (i < HISTOGRAM_SUB) {
+		return i;
+	}
+	int shift = (i - HISTOGRAM_SUB) / HISTOGRAM_SUB;
+	uint64_t m = HISTOGRAM_SUB + (i - HISTOGRAM_SUB) % HISTOGRAM_SUB;
+	return ((m + 1) << shift) - 1;
+}
+
+static uint64_t histogram_percentile(double p) {
+	if (stats.frames == 0) {
+		return 0;
+	}
+	uint64_t rank = (uint64_t)(p * (stats.frames - 1)) + 1;
+	uint64_t seen = 0;
+	for (size_t i = 0; i < HISTOGRAM_LEN; i++) {
+		seen += stats.render_ns[i];
+		if (seen >= rank) {
+			uint64_t v = histogram_value(i);
+			return v < stats.render_max_ns ? v : stats.render_max_ns;
+		}
+	}
+	return stats.render_max_ns;
+}
+
+void frame_stats_frame(struct slurp_output *output, uint64_t start,
+		size_t pixels) {
+	if (!frame_stats_enabled) {
+		return;
+	}
+	uint64_t ns = frame_stats_now() - start;
+	output->frames++;
+	stats.frames++;
+	stats.render_ns[histogram_index(ns)]++;
+	if (ns > stats.render_max_ns) {
+		stats.render_max_ns = ns;
+	}
+	stats.pixels += pixels;
+}
+
+void frame_stats_dropped(struct slurp_output *output) {
+	if (!frame_stats_enabled) {
+		return;
+	}
+	output->frames_dropped++;
+	stats.dropped++;
+}
+
+void frame_stats_buffer_created(void) {
+	stats.buffers_created++;
+}
+
+static void shm_add(size_t size) {
+	stats.shm_mapped += size;
+	if (stats.shm_mapped > stats.shm_peak) {
+		stats.shm_peak = stats.shm_mapped;
+	}
+}
+
+void frame_stats_shm_mapped(size_t size) {
+	stats.pools_created++;
+	shm_add(size);
+}
+
+void frame_stats_shm_unmapped(size_t size) {
+	stats.shm_mapped -= size;
+}
+
+void frame_stats_shm_reclaimed(size_t size) {
+	stats.buffers_reclaimed++;
+	stats.shm_mapped -= size;
+}
+
+void frame_stats_shm_restored(size_t size) {
+	shm_add(size);
+}
+
+void frame_stats_motion(void) {
+	stats.motion_events++;
+}
+
+// One record per line, made of a type followed by key=value pairs.
+void frame_stats_print(struct slurp_state *state, int fd) {
+	struct slurp_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		const char *name = output->logical_geometry.label;
+		dprintf(fd, "output name=%s frames=%llu dropped=%llu\n",
+			name != NULL ? name : "unknown",
+			(unsigned long long)output->frames,
+			(unsigned long long)output->frames_dropped);
+	}
+	dprintf(fd, "total frames=%llu dropped=%llu "
+		"render_p50_ns=%llu render_p90_ns=%llu render_p99_ns=%llu "
+		"render_max_ns=%llu pixels=%llu bytes=%llu buffers_created=%llu "
+		"pools_created=%llu shm_peak_bytes=%llu buffers_reclaimed=%llu "
+		"motion_events=%llu\n",
+		(unsigned long long)stats.frames,
+		(unsigned long long)stats.dropped,
+		(unsigned long long)histogram_percentile(0.50),
+		(unsigned long long)histogram_percentile(0.90),
+		(unsigned long long)histogram_percentile(0.99),
+		(unsigned long long)stats.render_max_ns,
+		(unsigned long long)stats.pixels,
+		(unsigned long long)(stats.pixels * sizeof(uint32_t)),
+		(unsigned long long)stats.buffers_created,
+		(unsigned long long)stats.pools_created,
+		(unsigned long long)stats.shm_peak,
+		(unsigned long long)stats.buffers_reclaimed,
+		(unsigned long long)stats.motion_events);
+}
@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include "hint.h"
+#include "slurp.h"
+
+void hints_invalidate(struct slurp_hints *hints) {
+	hints->valid = false;
+}
+
+void hints_move_box(struct slurp_hints *hints, const struct slurp_box *box) {
+	if (hints->valid && box->hint < hints->len) {
+		hints->boxes[box->hint] = *box;
+	}
+}
+
+// number of boxes below a node at the given depth
+static size_t subtree_size(const struct slurp_hints *hints, size_t depth) {
+	size_t n = 1;
+	for (size_t i = depth; i < hints->hint_len; i++) {
+		n *= HINT_KEYS_LEN;
+	}
+	return n;
+}
+
+static void set_range(struct slurp_hints *hints) {
+	size_t prefix = 0;
+	for (size_t i = 0; i < hints->typed_len; i++) {
+		prefix = prefix * HINT_KEYS_LEN + hints->typed[i];
+	}
+	size_t size = subtree_size(hints, hints->typed_len);
+	hints->lo = prefix * size;
+	hints->hi = hints->lo + size;
+	if (hints->hi > hints->len) {
+		hints->hi = hints->len;
+	}
+}
+
+bool hints_update(struct slurp_state *state) {
+	struct slurp_hints *hints = state->hints;
+	if (hints->valid) {
+		return true;
+	}
+
+	hints->len = 0;
+	struct slurp_box *box;
+	wl_list_for_each(box, &state->boxes, link) {
+		if (hints->len == hints->cap) {
+			size_t cap = hints->cap ? hints->cap * 2 : 64;
+			struct slurp_box *boxes =
+				realloc(hints->boxes, cap * sizeof(*boxes));
+			if (boxes == NULL) {
+				fprintf(stderr, "allocation failed\n");
+				return false;
+			}
+			hints->boxes = boxes;
+			hints->cap = cap;
+		}
+		box->hint = hints->len;
+		hints->boxes[hints->len++] = *box;
+	}
+
+	hints->hint_len = 1;
+	for (size_t n = HINT_KEYS_LEN; n < hints->len &&
+			hints->hint_len < HINT_MAX_LEN; n *= HINT_KEYS_LEN) {
+		hints->hint_len++;
+	}
+	// the boxes changed, so did the hints
+	hints->typed_len = 0;
+	set_range(hints);
+	hints->valid = true;
+	return true;
+}
+
+static void damage_range(struct slurp_state *state, size_t lo, size_t hi) {
+	if (lo < hi && state->boxes_damage != NULL) {
+		state->boxes_damage(state, &state->hints->boxes[lo], hi - lo);
+	}
+}
+
+// Marks the boxes shown before or after the change for redraw
+static void damage_change(struct slurp_state *state, size_t old_lo,
+		size_t old_hi) {
+	struct slurp_hints *hints = state->hints;
+	if (old_lo < hints->lo) {
+		damage_range(state, old_lo, hints->lo);
+	} else {
+		damage_range(state, hints->lo, old_lo);
+	}
+	if (old_hi > hints->hi) {
+		damage_range(state, hints->hi, old_hi);
+	} else {
+		damage_range(state, old_hi, hints->hi);
+	}
+}
+
+bool hints_handle_key(struct slurp_state *state, uint32_t keysym) {
+	struct slurp_hints *hints = state->hints;
+	const char *key = NULL;
+	if (keysym < 0x80 && keysym != 0) {
+		key = strchr(HINT_KEYS, (int)keysym);
+	}
+	if (keysym != XKB_KEY_BackSpace && key == NULL) {
+		return false;
+	}
+	if (!hints_update(state) || hints->len == 0) {
+		return true;
+	}
+
+	size_t old_lo = hints->lo, old_hi = hints->hi;
+	if (keysym == XKB_KEY_BackSpace) {
+		if (hints->typed_len == 0) {
+			return true;
+		}
+		hints->typed_len--;
+		set_range(hints);
+		damage_change(state, old_lo, old_hi);
+		return true;
+	}
+
+	if (hints->typed_len == hints->hint_len) {
+		return true;
+	}
+	hints->typed[hints->typed_len++] = key - HINT_KEYS;
+	set_range(hints);
+	if (hints->lo >= hints->len) {
+		// no such hint
+		hints->typed_len--;
+		set_range(hints);
+		return true;
+	}
+	damage_change(state, old_lo, old_hi);
+
+	// only a key that matched can pick the box
+	if (hints->hi - hints->lo == 1) {
+		state->result = hints->boxes[hints->lo];
+		state->running = false;
+	}
+	return true;
+}
+
+size_t hints_get(const struct slurp_hints *hints, size_t i,
+		uint8_t keys[static HINT_MAX_LEN]) {
+	for (size_t j = hints->hint_len; j > 0; j--) {
+		keys[j - 1] = i % HINT_KEYS_LEN;
+		i /= HINT_KEYS_LEN;
+	}
+	return hints->hint_len;
+}
+
+void hints_finish(struct slurp_hints *hints) {
+	free(hints->boxes);
+	hints->boxes = NULL;
+	hints->len = hints->cap = 0;
+	hints->valid = false;
+}
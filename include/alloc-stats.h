@@ -0,0 +1,17 @@
+#ifndef _ALLOC_STATS_H
+#define _ALLOC_STATS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+// Counts the allocations and mappings made between frames, enabled with the
+// alloc-stats build option.
+#ifdef SLURP_ALLOC_STATS
+void alloc_stats_frame(bool warmup);
+void alloc_stats_print(FILE *f);
+#else
+static inline void alloc_stats_frame(bool warmup) {}
+static inline void alloc_stats_print(FILE *f) {}
+#endif
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+
+#include <stdio.h>
+
+struct slurp_state;
+
+enum capture_format {
+	CAPTURE_FORMAT_PPM,
+	CAPTURE_FORMAT_PNG,
+	CAPTURE_FORMAT_QOI,
+};
+
+int slurp_capture(struct slurp_state *state, enum capture_format format,
+	FILE *stream);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef _CONTROL_H
+#define _CONTROL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "slurp.h"
+
+#define CONTROL_LINE_MAX 4096
+
+// Reads choice box updates from a file descriptor while the overlay is
+// shown, one command per line:
+//
+//   add <id> <x>,<y> <width>x<height> [label]
+//   move <id> <x>,<y> <width>x<height>
+//   remove <id>
+//
+// Ids are positive integers chosen by the writer. The boxes are found
+// through an open addressing table keyed by id.
+struct slurp_control {
+	int fd;
+	int fd_flags;
+	bool eof;
+
+	char buf[CONTROL_LINE_MAX];
+	size_t buf_len;
+	bool overflow; // the current line is too long and is skipped
+
+	struct slurp_box **table; // NULL or a box with a non-zero id
+	size_t len, cap;
+};
+
+bool control_init(struct slurp_control *control, int fd);
+// Reads and applies the available commands
+void control_read(struct slurp_control *control, struct slurp_state *state);
+// Called before a box with an id is freed
+void control_forget(struct slurp_control *control,
+	const struct slurp_box *box);
+void control_finish(struct slurp_control *control);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef _FILL_H
+#define _FILL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A 32-bit premultiplied ARGB image, as laid out by cairo's ARGB32 format.
+struct fill_target {
+	uint32_t *data;
+	int32_t width, height;
+	int32_t stride; // in pixels
+};
+
+void fill_init(void);
+uint32_t fill_color_from_rgba(uint32_t color);
+// Both return the number of pixels written
+size_t fill_rect(const struct fill_target *target, int32_t x, int32_t y,
+	int32_t width, int32_t height, uint32_t color);
+size_t fill_border(const struct fill_target *target, int32_t x, int32_t y,
+	int32_t width, int32_t height, int32_t weight, uint32_t color);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef _FORMAT_H
+#define _FORMAT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct slurp_box;
+struct slurp_state;
+
+enum format_token_type {
+	FORMAT_TOKEN_LITERAL,
+	FORMAT_TOKEN_X,
+	FORMAT_TOKEN_Y,
+	FORMAT_TOKEN_WIDTH,
+	FORMAT_TOKEN_HEIGHT,
+	FORMAT_TOKEN_OUTPUT_X,
+	FORMAT_TOKEN_OUTPUT_Y,
+	FORMAT_TOKEN_OUTPUT_WIDTH,
+	FORMAT_TOKEN_OUTPUT_HEIGHT,
+	FORMAT_TOKEN_LABEL,
+	FORMAT_TOKEN_OUTPUT_NAME,
+};
+
+struct format_token {
+	enum format_token_type type;
+	// literal text, points into the compiled format string
+	const char *text;
+	size_t len;
+};
+
+// A format string compiled once into a token list. Results are rendered
+// into an internal buffer which is reused across calls.
+struct format {
+	bool json;
+	struct format_token *tokens;
+	size_t len;
+
+	char *buf;
+	size_t buf_len, buf_cap;
+};
+
+bool format_compile(struct format *format, const char *str);
+void format_init_json(struct format *format);
+const char *format_render(struct format *format, struct slurp_state *state,
+	const struct slurp_box *result, size_t *len);
+void format_finish(struct format *format);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef _FRAME_STATS_H
+#define _FRAME_STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct slurp_output;
+struct slurp_state;
+
+// Frame and buffer counters, printed at exit with -T. Nothing is counted
+// unless frame_stats_enable() was called.
+extern bool frame_stats_enabled;
+
+void frame_stats_enable(void);
+uint64_t frame_stats_now(void);
+void frame_stats_frame(struct slurp_output *output, uint64_t start,
+	size_t pixels);
+void frame_stats_dropped(struct slurp_output *output);
+void frame_stats_buffer_created(void);
+void frame_stats_shm_mapped(size_t size);
+void frame_stats_shm_unmapped(size_t size);
+// memory given back and faulted in again by a kept mapping
+void frame_stats_shm_reclaimed(size_t size);
+void frame_stats_shm_restored(size_t size);
+void frame_stats_motion(void);
+void frame_stats_print(struct slurp_state *state, int fd);
+
+#endif
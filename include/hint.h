@@ -0,0 +1,39 @@
+#ifndef _HINT_H
+#define _HINT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "slurp.h"
+
+// home row keys, in the order hints use them
+#define HINT_KEYS "asdfghjkl"
+#define HINT_KEYS_LEN (sizeof(HINT_KEYS) - 1)
+#define HINT_MAX_LEN 16
+
+// Picks a choice box by typing the hint drawn on it. All hints have the
+// same length, box i gets the digits of i in base HINT_KEYS_LEN. Together
+// they form a complete trie, so the boxes below a typed prefix are the
+// contiguous range [lo, hi) and each key narrows it with a multiplication.
+struct slurp_hints {
+	struct slurp_box *boxes; // copies of the choice boxes, in hint order
+	size_t len, cap;
+	size_t hint_len;
+	uint8_t typed[HINT_MAX_LEN];
+	size_t typed_len;
+	size_t lo, hi;
+	bool valid;
+};
+
+void hints_invalidate(struct slurp_hints *hints);
+// A moved box keeps its hint and the keys typed so far stay
+void hints_move_box(struct slurp_hints *hints, const struct slurp_box *box);
+bool hints_update(struct slurp_state *state);
+bool hints_handle_key(struct slurp_state *state, uint32_t keysym);
+// Writes the indices into HINT_KEYS of box i's hint, returns its length
+size_t hints_get(const struct slurp_hints *hints, size_t i,
+	uint8_t keys[static HINT_MAX_LEN]);
+void hints_finish(struct slurp_hints *hints);
+
+#endif
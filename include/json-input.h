@@ -0,0 +1,27 @@
+#ifndef _JSON_INPUT_H
+#define _JSON_INPUT_H
+
+#include <stdbool.h>
+
+struct slurp_state;
+
+enum json_input_field {
+	JSON_INPUT_X,
+	JSON_INPUT_Y,
+	JSON_INPUT_WIDTH,
+	JSON_INPUT_HEIGHT,
+	JSON_INPUT_LABEL,
+	JSON_INPUT_FIELD_COUNT,
+};
+
+// Dot-separated key paths, relative to a box object, of each field
+struct json_input_paths {
+	const char *paths[JSON_INPUT_FIELD_COUNT];
+};
+
+void json_input_paths_init(struct json_input_paths *paths);
+bool json_input_paths_set(struct json_input_paths *paths, const char *spec);
+bool json_input_read(struct slurp_state *state,
+	const struct json_input_paths *paths, int fd);
+
+#endif
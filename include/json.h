@@ -0,0 +1,45 @@
+#ifndef _JSON_H
+#define _JSON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Callbacks of the streaming parser. Strings and keys are NUL-terminated
+// and only valid for the duration of the callback.
+struct json_callbacks {
+	void (*object_start)(void *data);
+	void (*object_end)(void *data);
+	void (*array_start)(void *data);
+	void (*array_end)(void *data);
+	void (*key)(void *data, const char *key);
+	void (*string)(void *data, const char *value);
+	void (*number)(void *data, double value);
+	void (*boolean)(void *data, bool value);
+	void (*null)(void *data);
+};
+
+// A push parser: input is fed in chunks of any size and reported through
+// the callbacks as it is parsed, without building a document. Several
+// top-level values may follow each other.
+struct json_parser {
+	const struct json_callbacks *callbacks;
+	void *data;
+
+	int state;
+	bool in_key;
+	char *stack; // '{' or '[' for each open container
+	size_t depth, stack_cap;
+	char *token;
+	size_t token_len, token_cap;
+	unsigned int escape_len;
+	unsigned int codepoint, high_surrogate;
+	bool error;
+};
+
+void json_parser_init(struct json_parser *parser,
+	const struct json_callbacks *callbacks, void *data);
+bool json_parser_feed(struct json_parser *parser, const char *buf, size_t len);
+bool json_parser_finish(struct json_parser *parser);
+void json_parser_destroy(struct json_parser *parser);
+
+#endif
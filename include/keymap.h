@@ -0,0 +1,32 @@
+#ifndef _KEYMAP_H
+#define _KEYMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-client.h>
+#include <xkbcommon/xkbcommon.h>
+
+struct slurp_state;
+
+// A keymap shared by all seats using the same keymap text. slurp only
+// looks at unmodified keysyms, which are kept in a table indexed by
+// keycode. When the table comes from the on-disk cache, the keymap isn't
+// compiled at all and xkb_keymap is NULL.
+struct slurp_keymap {
+	uint64_t hash;
+	size_t size;
+	struct xkb_keymap *xkb_keymap;
+	xkb_keycode_t min_keycode;
+	uint32_t len;
+	xkb_keysym_t *keysyms;
+	struct wl_list link; // slurp_state::keymaps
+};
+
+struct slurp_keymap *keymap_from_buffer(struct slurp_state *state,
+	const char *buffer, size_t size);
+struct slurp_keymap *keymap_from_names(struct slurp_state *state);
+xkb_keysym_t keymap_get_keysym(const struct slurp_keymap *keymap,
+	xkb_keycode_t keycode);
+void keymap_destroy(struct slurp_keymap *keymap);
+
+#endif
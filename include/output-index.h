@@ -0,0 +1,23 @@
+#ifndef _OUTPUT_INDEX_H
+#define _OUTPUT_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "slurp.h"
+
+void output_index_invalidate(struct slurp_state *state);
+void output_index_finish(struct slurp_state *state);
+
+// Calls fn once for each output intersecting any of the boxes
+void output_index_for_each(struct slurp_state *state,
+	const struct slurp_box *boxes, size_t len,
+	void (*fn)(struct slurp_output *output, void *data), void *data);
+struct slurp_output *output_index_at(struct slurp_state *state,
+	int32_t x, int32_t y);
+// The output under the box's top-left corner or, if there is none, the one
+// sharing the largest area with the box
+struct slurp_output *output_index_from_box(struct slurp_state *state,
+	const struct slurp_box *box);
+
+#endif
@@ -10,14 +10,31 @@ struct pool_buffer {
 	struct wl_buffer *buffer;
 	cairo_surface_t *surface;
 	cairo_t *cairo;
-	uint32_t width, height;
+	uint32_t width, height, stride;
+	enum wl_shm_format format;
+	// kept across resizes, as long as the new size fits
+	struct wl_shm_pool *pool;
 	void *data;
 	size_t size;
 	bool busy;
+	// changes whenever the contents are replaced outside of render()
+	uint64_t serial;
+	// the memory was given back, see reclaim_buffer()
+	bool reclaimed;
 };
 
 struct pool_buffer *get_next_buffer(struct wl_shm *shm,
 	struct pool_buffer pool[static 2], uint32_t width, uint32_t height);
+struct pool_buffer *get_buffer(struct wl_shm *shm, struct pool_buffer *buffer,
+	uint32_t width, uint32_t height);
+struct pool_buffer *get_buffer_format(struct wl_shm *shm,
+	struct pool_buffer *buffer, uint32_t width, uint32_t height,
+	uint32_t stride, enum wl_shm_format format);
+struct pool_buffer *get_next_buffer_format(struct wl_shm *shm,
+	struct pool_buffer pool[static 2], uint32_t width, uint32_t height,
+	uint32_t stride, enum wl_shm_format format);
+void invalidate_buffer(struct pool_buffer *buffer);
+void reclaim_buffer(struct pool_buffer *buffer);
 void finish_buffer(struct pool_buffer *buffer);
 
 #endif
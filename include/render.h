@@ -1,8 +1,24 @@
 #ifndef _RENDER_H
 #define _RENDER_H
 
+#include <stddef.h>
+
+struct pool_buffer;
+struct slurp_box;
 struct slurp_output;
+struct slurp_state;
 
-void render(struct slurp_output *output);
+size_t render(struct slurp_output *output, struct slurp_box *damage);
+size_t render_background(struct slurp_state *state, struct pool_buffer *buffer);
+void render_invalidate_labels(struct slurp_output *output);
+// Updates the cached label of a box added or moved on the output
+void render_update_label(struct slurp_output *output,
+	const struct slurp_box *box);
+// Drops the cached label of a box before it is freed
+void render_remove_label(struct slurp_output *output,
+	const struct slurp_box *box);
+// The next frame damages the whole surface
+void render_damage_all(struct slurp_output *output);
+void render_finish(struct slurp_output *output);
 
 #endif
@@ -0,0 +1,62 @@
+#ifndef _SELECTION_H
+#define _SELECTION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "slurp.h"
+
+#define TOUCH_ID_EMPTY -1
+
+// The selection engine only sees these events, in layout coordinates, so
+// that it can run without a compositor. slurp.c translates the Wayland
+// input events into them.
+enum selection_event_type {
+	SELECTION_EVENT_POINTER_ENTER,
+	SELECTION_EVENT_POINTER_MOTION,
+	SELECTION_EVENT_POINTER_BUTTON,
+	SELECTION_EVENT_POINTER_AXIS,
+	SELECTION_EVENT_KEY,
+	SELECTION_EVENT_TOUCH_DOWN,
+	SELECTION_EVENT_TOUCH_MOTION,
+	SELECTION_EVENT_TOUCH_UP,
+	SELECTION_EVENT_TOUCH_CANCEL,
+};
+
+struct selection_event {
+	enum selection_event_type type;
+	// for axis events, y is -1 to scroll up and 1 to scroll down
+	int32_t x, y;
+	// button and key events
+	bool pressed;
+	uint32_t keysym;
+	// touch events
+	int32_t touch_id;
+};
+
+void selection_handle_event(struct slurp_seat *seat,
+	const struct selection_event *event);
+void selection_invalidate_hover(struct slurp_state *state);
+
+void selection_build_snap_edges(struct slurp_state *state);
+void selection_insert_snap_edges(struct slurp_state *state,
+	const struct slurp_box *box);
+void selection_remove_snap_edges(struct slurp_state *state,
+	const struct slurp_box *box);
+void selection_boxes_changed(struct slurp_state *state,
+	const struct slurp_box *areas, size_t len);
+void selection_forget_box(struct slurp_state *state,
+	const struct slurp_box *box);
+
+bool selection_record_open(struct slurp_state *state, const char *path);
+void selection_record_boxes_changed(struct slurp_state *state);
+void selection_record_add(struct slurp_state *state,
+	const struct slurp_box *box);
+void selection_record_move(struct slurp_state *state,
+	const struct slurp_box *box, const struct slurp_box *geometry);
+void selection_record_remove(struct slurp_state *state,
+	const struct slurp_box *box);
+void selection_record_leave(struct slurp_seat *seat);
+void selection_record_close(struct slurp_state *state);
+
+#endif
@@ -9,11 +9,56 @@
 extern "C" {
 #endif
 
+struct slurp_seat;
+struct slurp_control;
+struct slurp_hints;
+struct slurp_stream;
+struct selection_recorder;
+
+// how many levels a seat can move up the containment forest
+#define SLURP_NAV_DEPTH 32
+
 struct slurp_box {
 	int32_t x, y;
 	int32_t width, height;
 	char *label;
 	struct wl_list link;
+	uint32_t id; // set for boxes added through the control fd, or 0
+	size_t hint; // index in slurp_hints::boxes while the hints are valid
+	// the geometry before clipping to the chosen outputs, the box is in
+	// slurp_state::hidden_boxes while it's outside of all of them
+	struct {
+		int32_t x, y, width, height;
+	} requested;
+	bool hidden;
+
+	// containment forest, the parent is the smallest box containing this
+	// one, or just a containing one among partly overlapping boxes
+	struct slurp_box *parent;
+};
+
+struct slurp_edge_list {
+	int32_t *data;
+	uint32_t *counts; // boxes sharing each edge
+	size_t len, cap;
+};
+
+// Sorted, deduplicated edge coordinates of choice boxes and outputs
+struct slurp_edges {
+	struct slurp_edge_list x, y;
+	bool built;
+};
+
+// Grid over the output edges, see output-index.c
+struct slurp_output_index {
+	struct slurp_output **outputs;
+	size_t len;
+	size_t words; // per cell mask
+	int32_t *xs, *ys;
+	size_t xs_len, ys_len;
+	uint64_t *cells;
+	uint64_t *mask;
+	bool valid;
 };
 
 struct slurp_selection {
@@ -34,10 +79,16 @@ struct slurp_state {
 	struct wl_compositor *compositor;
 	struct zwlr_layer_shell_v1 *layer_shell;
 	struct zxdg_output_manager_v1 *xdg_output_manager;
+	struct zwlr_screencopy_manager_v1 *screencopy_manager;
 	struct wl_list outputs; // slurp_output::link
+	struct slurp_output_index output_index;
 	struct wl_list seats; // slurp_seat::link
+	// buffers with only the background, shared by idle outputs
+	struct wl_list idle_buffers; // slurp_idle_buffer::link
 
+	// created when a keymap needs to be compiled
 	struct xkb_context *xkb_context;
+	struct wl_list keymaps; // slurp_keymap::link
 
 	struct {
 		uint32_t background;
@@ -50,11 +101,15 @@ struct slurp_state {
 
 	uint32_t border_weight;
 	bool display_dimensions;
+	bool display_labels;
 	bool single_point;
 	bool restrict_selection;
 	struct wl_list boxes; // slurp_box::link
 	bool fixed_aspect_ratio;
 	double aspect_ratio;  // h / w
+	int32_t snap_threshold;
+	struct slurp_edges snap_edges;
+	bool forest_valid;
 
 	const char *cursor_theme;
 	int cursor_size;
@@ -62,6 +117,35 @@ struct slurp_state {
 	const char *error;
 	bool output_boxes;
 
+	// only show the overlay on the outputs in this comma-separated list
+	const char *output_names;
+	// only show the overlay on the first output the pointer enters
+	bool pointer_output;
+	struct slurp_output *chosen_output;
+	bool boxes_clipped;
+	struct wl_list hidden_boxes; // slurp_box::link
+
+	// only resolve a given geometry, nothing is shown
+	bool resolve_only;
+	// sway IPC connection with a pending GET_TREE, or -1
+	int sway_ipc_fd;
+	// live selection output, if enabled
+	struct slurp_stream *stream;
+	// input recording, if enabled
+	struct selection_recorder *recorder;
+	// keyboard hints, if enabled
+	struct slurp_hints *hints;
+	// choice box updates, if enabled
+	struct slurp_control *control;
+	// buffers unused for this many milliseconds give their memory back,
+	// 0 keeps it
+	int reclaim_delay;
+	// redraws the outputs under a seat's selection, may be NULL
+	void (*selection_damage)(struct slurp_seat *seat);
+	// redraws the outputs under the boxes, may be NULL
+	void (*boxes_damage)(struct slurp_state *state,
+		const struct slurp_box *boxes, size_t len);
+
 	struct slurp_box result;
 };
 
@@ -78,13 +162,21 @@ struct slurp_output {
 	struct zwlr_layer_surface_v1 *layer_surface;
 
 	struct zxdg_output_v1 *xdg_output;
+	bool wl_output_done, xdg_output_done;
+	bool has_output_box;
 
 	struct wl_callback *frame_callback;
 	bool configured;
 	bool dirty;
+	bool first_frame_done;
+	uint64_t last_frame_ms; // see reclaim_buffers()
+	// see frame-stats.c
+	uint64_t frames, frames_dropped;
 	int32_t width, height;
 	struct pool_buffer *buffers;
 	struct pool_buffer *current_buffer;
+	// fonts and glyphs reused across frames, see render.c
+	struct render_cache *render_cache;
 
 	struct wl_cursor_theme *cursor_theme;
 	struct wl_cursor_image *cursor_image;
@@ -95,6 +187,7 @@ struct slurp_seat {
 	struct slurp_state *state;
 	struct wl_seat *wl_seat;
 	struct wl_list link; // slurp_state::seats
+	int id; // index in creation order
 
 	// keyboard:
 	struct wl_keyboard *wl_keyboard;
@@ -107,10 +200,22 @@ struct slurp_seat {
 	// pointer:
 	struct wl_pointer *wl_pointer;
 	enum wl_pointer_button_state button_state;
+	// the pointer selection doesn't change while the cursor stays inside
+	// hover_region
+	struct slurp_box hover_region;
+	bool hover_valid;
+	// the box the selection shows, nav_depth parents above the hovered one,
+	// nav_path holds the boxes left on the way up
+	struct slurp_box *nav_box;
+	struct slurp_box *nav_path[SLURP_NAV_DEPTH];
+	int nav_depth;
+	// scrolling, see pointer_handle_axis()
+	int32_t axis_source; // -1 if unknown
+	bool axis_discrete; // the current frame had wheel clicks
+	double axis_pending;
 
 	// keymap:
-	struct xkb_keymap *xkb_keymap;
-	struct xkb_state *xkb_state;
+	struct slurp_keymap *keymap;
 
 	// touch:
 	struct wl_touch *wl_touch;
@@ -127,11 +232,27 @@ void slurp_state_init(struct slurp_state *state);
 
 int slurp_select(struct slurp_state *state);
 
+int slurp_resolve(struct slurp_state *state, const struct slurp_box *box);
+
+void slurp_unmap(struct slurp_state *state);
+
 void slurp_destroy(struct slurp_state *state);
 
 struct slurp_output *slurp_output_from_box(const struct slurp_box *box, struct wl_list *outputs);
 
-void slurp_add_choice_box(struct slurp_state *state, const struct slurp_box *box);
+struct slurp_box *slurp_add_choice_box(struct slurp_state *state,
+	const struct slurp_box *box);
+void slurp_move_choice_box(struct slurp_state *state, struct slurp_box *box,
+	const struct slurp_box *geometry);
+void slurp_remove_choice_box(struct slurp_state *state, struct slurp_box *box);
+
+static inline bool slurp_box_contains(const struct slurp_box *box,
+		int32_t x, int32_t y) {
+	return box->x <= x
+		&& box->x + box->width > x
+		&& box->y <= y
+		&& box->y + box->height > y;
+}
 
 static inline bool slurp_box_intersect(const struct slurp_box *a, const struct slurp_box *b) {
 	return a->x < b->x + b->width &&
@@ -0,0 +1,38 @@
+#ifndef _STREAM_H
+#define _STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "slurp.h"
+
+struct format;
+
+// Writes the selection to a file descriptor as it changes. Writes never
+// block: a record that doesn't fit is kept and finished when the descriptor
+// becomes writable, newer records replace it as long as none of it has been
+// written. When nothing is selected anymore, an empty line is written, or
+// null with JSON output.
+struct slurp_stream {
+	int fd;
+	int fd_flags;
+	struct format *format;
+
+	struct slurp_box box;
+	bool cleared; // nothing is selected, box is unused
+	bool dirty;
+
+	char *pending;
+	size_t pending_len, pending_written, pending_cap;
+	bool failed;
+};
+
+bool stream_init(struct slurp_stream *stream, int fd, struct format *format);
+void stream_set_box(struct slurp_stream *stream, const struct slurp_box *box);
+void stream_clear(struct slurp_stream *stream);
+void stream_frame(struct slurp_stream *stream, struct slurp_state *state);
+bool stream_wants_write(const struct slurp_stream *stream);
+void stream_flush(struct slurp_stream *stream);
+void stream_finish(struct slurp_stream *stream);
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef _SWAY_IPC_H
+#define _SWAY_IPC_H
+
+#include <stdbool.h>
+
+struct slurp_state;
+
+bool sway_ipc_request_tree(struct slurp_state *state);
+bool sway_ipc_read_tree(struct slurp_state *state);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef _TILE_POOL_H
+#define _TILE_POOL_H
+
+#include <stddef.h>
+
+#define TILE_POOL_MAX_THREADS 16
+
+// Calls fn(data, i) for every i in [0, len) on a pool of worker threads and
+// returns once all calls are done. The calling thread takes part. Workers
+// are started on the first call, one less than the number of CPUs.
+void tile_pool_run(void (*fn)(void *data, size_t i), void *data, size_t len);
+void tile_pool_finish(void);
+
+#endif
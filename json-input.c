@@ -0,0 +1,282 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "json.h"
+#include "json-input.h"
+#include "slurp.h"
+
+static const char *field_names[] = {
+	[JSON_INPUT_X] = "x",
+	[JSON_INPUT_Y] = "y",
+	[JSON_INPUT_WIDTH] = "width",
+	[JSON_INPUT_HEIGHT] = "height",
+	[JSON_INPUT_LABEL] = "label",
+};
+
+#define JSON_INPUT_BOX_FIELDS ((1 << JSON_INPUT_LABEL) - 1)
+
+struct input_frame {
+	bool is_object;
+	// last key seen in this object, the buffer is kept when the frame is
+	// reused
+	char *key;
+	size_t key_cap;
+	// fields found below this object
+	unsigned int fields;
+	struct slurp_box box;
+	char *label;
+};
+
+// Every object is a candidate box. When a value is parsed, the keys leading
+// to it are matched against the paths from each enclosing object, so the
+// document is never kept in memory.
+struct input_parser {
+	struct slurp_state *state;
+	const struct json_input_paths *paths;
+	size_t path_len[JSON_INPUT_FIELD_COUNT];
+
+	struct input_frame *frames;
+	size_t depth, cap;
+	bool failed;
+};
+
+void json_input_paths_init(struct json_input_paths *paths) {
+	for (size_t i = 0; i < JSON_INPUT_FIELD_COUNT; i++) {
+		paths->paths[i] = field_names[i];
+	}
+}
+
+// Parses a field=path specification, the path is referenced, not copied.
+bool json_input_paths_set(struct json_input_paths *paths, const char *spec) {
+	const char *eq = strchr(spec, '=');
+	if (eq == NULL || eq[1] == '\0') {
+		return false;
+	}
+	for (size_t i = 0; i < JSON_INPUT_FIELD_COUNT; i++) {
+		size_t len = strlen(field_names[i]);
+		if ((size_t)(eq - spec) == len &&
+				strncmp(spec, field_names[i], len) == 0) {
+			paths->paths[i] = eq + 1;
+			return true;
+		}
+	}
+	return false;
+}
+
+static size_t path_length(const char *path) {
+	size_t len = 1;
+	for (const char *c = path; *c; c++) {
+		if (*c == '.') {
+			len++;
+		}
+	}
+	return len;
+}
+
+// Checks whether path names the keys of frames [start, depth).
+static bool path_matches(struct input_parser *input, const char *path,
+		size_t start) {
+	for (size_t i = start; i < input->depth; i++) {
+		const char *key = input->frames[i].key;
+		size_t len = strlen(key);
+		if (strncmp(path, key, len) != 0) {
+			return false;
+		}
+		path += len;
+		if (i + 1 < input->depth) {
+			if (*path != '.') {
+				return false;
+			}
+			path++;
+		}
+	}
+	return *path == '\0';
+}
+
+// Returns the object a value at the current position belongs to as the given
+// field, if any.
+static struct input_frame *match_field(struct input_parser *input,
+		enum json_input_field field) {
+	size_t len = input->path_len[field];
+	if (input->failed || len > input->depth) {
+		return NULL;
+	}
+	size_t start = input->depth - len;
+	for (size_t i = start; i < input->depth; i++) {
+		if (!input->frames[i].is_object || input->frames[i].key == NULL) {
+			return NULL;
+		}
+	}
+	if (!path_matches(input, input->paths->paths[field], start)) {
+		return NULL;
+	}
+	return &input->frames[start];
+}
+
+static void push_frame(struct input_parser *input, bool is_object) {
+	if (input->failed) {
+		return;
+	}
+	if (input->depth == input->cap) {
+		size_t cap = input->cap ? input->cap * 2 : 32;
+		struct input_frame *frames = realloc(input->frames,
+			cap * sizeof(*frames));
+		if (frames == NULL) {
+			fprintf(stderr, "allocation failed\n");
+			input->failed = true;
+			return;
+		}
+		memset(&frames[input->cap], 0,
+			(cap - input->cap) * sizeof(*frames));
+		input->frames = frames;
+		input->cap = cap;
+	}
+	struct input_frame *frame = &input->frames[input->depth++];
+	frame->is_object = is_object;
+	frame->fields = 0;
+	frame->box = (struct slurp_box){0};
+	if (frame->key != NULL) {
+		frame->key[0] = '\0';
+	}
+}
+
+static void pop_frame(struct input_parser *input) {
+	if (!input->failed) {
+		input->depth--;
+	}
+}
+
+static void input_handle_object_start(void *data) {
+	push_frame(data, true);
+}
+
+static void input_handle_object_end(void *data) {
+	struct input_parser *input = data;
+	if (input->failed) {
+		return;
+	}
+	struct input_frame *frame = &input->frames[input->depth - 1];
+	if ((frame->fields & JSON_INPUT_BOX_FIELDS) == JSON_INPUT_BOX_FIELDS) {
+		frame->box.label = frame->label;
+		slurp_add_choice_box(input->state, &frame->box);
+	}
+	free(frame->label);
+	frame->label = NULL;
+	pop_frame(input);
+}
+
+static void input_handle_array_start(void *data) {
+	push_frame(data, false);
+}
+
+static void input_handle_array_end(void *data) {
+	pop_frame(data);
+}
+
+static void input_handle_key(void *data, const char *key) {
+	struct input_parser *input = data;
+	if (input->failed) {
+		return;
+	}
+	struct input_frame *frame = &input->frames[input->depth - 1];
+	size_t len = strlen(key) + 1;
+	if (len > frame->key_cap) {
+		char *buf = realloc(frame->key, len);
+		if (buf == NULL) {
+			fprintf(stderr, "allocation failed\n");
+			input->failed = true;
+			return;
+		}
+		frame->key = buf;
+		frame->key_cap = len;
+	}
+	memcpy(frame->key, key, len);
+}
+
+static void input_handle_string(void *data, const char *value) {
+	struct input_parser *input = data;
+	struct input_frame *frame = match_field(input, JSON_INPUT_LABEL);
+	if (frame != NULL) {
+		free(frame->label);
+		frame->label = strdup(value);
+	}
+}
+
+static void input_handle_number(void *data, double value) {
+	struct input_parser *input = data;
+	for (int field = JSON_INPUT_X; field <= JSON_INPUT_HEIGHT; field++) {
+		struct input_frame *frame = match_field(input, field);
+		if (frame == NULL) {
+			continue;
+		}
+		switch (field) {
+		case JSON_INPUT_X:
+			frame->box.x = value;
+			break;
+		case JSON_INPUT_Y:
+			frame->box.y = value;
+			break;
+		case JSON_INPUT_WIDTH:
+			frame->box.width = value;
+			break;
+		case JSON_INPUT_HEIGHT:
+			frame->box.height = value;
+			break;
+		}
+		frame->fields |= 1 << field;
+	}
+}
+
+static const struct json_callbacks input_callbacks = {
+	.object_start = input_handle_object_start,
+	.object_end = input_handle_object_end,
+	.array_start = input_handle_array_start,
+	.array_end = input_handle_array_end,
+	.key = input_handle_key,
+	.string = input_handle_string,
+	.number = input_handle_number,
+};
+
+bool json_input_read(struct slurp_state *state,
+		const struct json_input_paths *paths, int fd) {
+	struct input_parser input = {
+		.state = state,
+		.paths = paths,
+	};
+	for (size_t i = 0; i < JSON_INPUT_FIELD_COUNT; i++) {
+		input.path_len[i] = path_length(paths->paths[i]);
+	}
+
+	struct json_parser parser;
+	json_parser_init(&parser, &input_callbacks, &input);
+
+	bool ok = true;
+	char buf[65536];
+	while (ok) {
+		ssize_t n = read(fd, buf, sizeof(buf));
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0) {
+			ok = false;
+		} else if (n == 0) {
+			break;
+		} else {
+			ok = json_parser_feed(&parser, buf, n);
+		}
+	}
+	ok = ok && json_parser_finish(&parser) && !input.failed;
+
+	for (size_t i = 0; i < input.cap; i++) {
+		free(input.frames[i].key);
+		free(input.frames[i].label);
+	}
+	free(input.frames);
+	json_parser_destroy(&parser);
+	return ok;
+}
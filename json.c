@@ -0,0 +1,342 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json.h"
+
+enum json_state {
+	JSON_VALUE,
+	JSON_VALUE_OR_ARRAY_END,
+	JSON_KEY,
+	JSON_KEY_OR_OBJECT_END,
+	JSON_COLON,
+	JSON_AFTER_VALUE,
+	JSON_STRING,
+	JSON_STRING_ESCAPE,
+	JSON_STRING_UNICODE,
+	JSON_NUMBER,
+	JSON_LITERAL,
+};
+
+static bool is_space(char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static bool token_push(struct json_parser *parser, char c) {
+	// keep room for the NUL terminator
+	if (parser->token_len + 1 >= parser->token_cap) {
+		size_t cap = parser->token_cap ? parser->token_cap * 2 : 64;
+		char *token = realloc(parser->token, cap);
+		if (token == NULL) {
+			return false;
+		}
+		parser->token = token;
+		parser->token_cap = cap;
+	}
+	parser->token[parser->token_len++] = c;
+	return true;
+}
+
+static const char *token_end(struct json_parser *parser) {
+	if (!token_push(parser, '\0')) {
+		return NULL;
+	}
+	parser->token_len = 0;
+	return parser->token;
+}
+
+static bool push_utf8(struct json_parser *parser, uint32_t cp) {
+	if (cp < 0x80) {
+		return token_push(parser, cp);
+	} else if (cp < 0x800) {
+		return token_push(parser, 0xC0 | cp >> 6) &&
+			token_push(parser, 0x80 | (cp & 0x3F));
+	} else if (cp < 0x10000) {
+		return token_push(parser, 0xE0 | cp >> 12) &&
+			token_push(parser, 0x80 | (cp >> 6 & 0x3F)) &&
+			token_push(parser, 0x80 | (cp & 0x3F));
+	}
+	return token_push(parser, 0xF0 | cp >> 18) &&
+		token_push(parser, 0x80 | (cp >> 12 & 0x3F)) &&
+		token_push(parser, 0x80 | (cp >> 6 & 0x3F)) &&
+		token_push(parser, 0x80 | (cp & 0x3F));
+}
+
+static bool push_container(struct json_parser *parser, char c) {
+	if (parser->depth == parser->stack_cap) {
+		size_t cap = parser->stack_cap ? parser->stack_cap * 2 : 16;
+		char *stack = realloc(parser->stack, cap);
+		if (stack == NULL) {
+			return false;
+		}
+		parser->stack = stack;
+		parser->stack_cap = cap;
+	}
+	parser->stack[parser->depth++] = c;
+	return true;
+}
+
+static bool pop_container(struct json_parser *parser, char c) {
+	if (parser->depth == 0 || parser->stack[parser->depth - 1] != c) {
+		return false;
+	}
+	parser->depth--;
+	parser->state = JSON_AFTER_VALUE;
+	return true;
+}
+
+#define EMIT(parser, cb, ...) \
+	do { \
+		if ((parser)->callbacks->cb) { \
+			(parser)->callbacks->cb((parser)->data, ##__VA_ARGS__); \
+		} \
+	} while (0)
+
+static bool end_string(struct json_parser *parser) {
+	const char *str = token_end(parser);
+	if (str == NULL) {
+		return false;
+	}
+	if (parser->in_key) {
+		EMIT(parser, key, str);
+		parser->state = JSON_COLON;
+	} else {
+		EMIT(parser, string, str);
+		parser->state = JSON_AFTER_VALUE;
+	}
+	return true;
+}
+
+static bool end_number(struct json_parser *parser) {
+	const char *str = token_end(parser);
+	if (str == NULL) {
+		return false;
+	}
+	char *end;
+	double value = strtod(str, &end);
+	if (end == str || *end != '\0') {
+		return false;
+	}
+	EMIT(parser, number, value);
+	parser->state = JSON_AFTER_VALUE;
+	return true;
+}
+
+static bool end_literal(struct json_parser *parser) {
+	const char *str = token_end(parser);
+	if (str == NULL) {
+		return false;
+	}
+	if (strcmp(str, "true") == 0) {
+		EMIT(parser, boolean, true);
+	} else if (strcmp(str, "false") == 0) {
+		EMIT(parser, boolean, false);
+	} else if (strcmp(str, "null") == 0) {
+		EMIT(parser, null);
+	} else {
+		return false;
+	}
+	parser->state = JSON_AFTER_VALUE;
+	return true;
+}
+
+static bool parse_value_start(struct json_parser *parser, char c) {
+	switch (c) {
+	case '{':
+		EMIT(parser, object_start);
+		parser->state = JSON_KEY_OR_OBJECT_END;
+		return push_container(parser, '{');
+	case '[':
+		EMIT(parser, array_start);
+		parser->state = JSON_VALUE_OR_ARRAY_END;
+		return push_container(parser, '[');
+	case '"':
+		parser->in_key = false;
+		parser->state = JSON_STRING;
+		return true;
+	case '-':
+	case '0': case '1': case '2': case '3': case '4':
+	case '5': case '6': case '7': case '8': case '9':
+		parser->state = JSON_NUMBER;
+		return token_push(parser, c);
+	case 't':
+	case 'f':
+	case 'n':
+		parser->state = JSON_LITERAL;
+		return token_push(parser, c);
+	default:
+		return false;
+	}
+}
+
+static bool parse_char(struct json_parser *parser, char c) {
+	switch (parser->state) {
+	case JSON_NUMBER:
+		if ((c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' ||
+				c == '+' || c == '-') {
+			return token_push(parser, c);
+		}
+		if (!end_number(parser)) {
+			return false;
+		}
+		return parse_char(parser, c);
+	case JSON_LITERAL:
+		if (c >= 'a' && c <= 'z') {
+			return token_push(parser, c);
+		}
+		if (!end_literal(parser)) {
+			return false;
+		}
+		return parse_char(parser, c);
+	case JSON_STRING:
+		if (c == '"') {
+			return end_string(parser);
+		} else if (c == '\\') {
+			parser->state = JSON_STRING_ESCAPE;
+			return true;
+		} else if ((unsigned char)c < 0x20) {
+			return false;
+		}
+		return token_push(parser, c);
+	case JSON_STRING_ESCAPE:
+		parser->state = JSON_STRING;
+		switch (c) {
+		case '"':
+		case '\\':
+		case '/':
+			return token_push(parser, c);
+		case 'b':
+			return token_push(parser, '\b');
+		case 'f':
+			return token_push(parser, '\f');
+		case 'n':
+			return token_push(parser, '\n');
+		case 'r':
+			return token_push(parser, '\r');
+		case 't':
+			return token_push(parser, '\t');
+		case 'u':
+			parser->state = JSON_STRING_UNICODE;
+			parser->escape_len = 0;
+			parser->codepoint = 0;
+			return true;
+		default:
+			return false;
+		}
+	case JSON_STRING_UNICODE:;
+		unsigned int digit;
+		if (c >= '0' && c <= '9') {
+			digit = c - '0';
+		} else if (c >= 'a' && c <= 'f') {
+			digit = c - 'a' + 10;
+		} else if (c >= 'A' && c <= 'F') {
+			digit = c - 'A' + 10;
+		} else {
+			return false;
+		}
+		parser->codepoint = parser->codepoint << 4 | digit;
+		if (++parser->escape_len < 4) {
+			return true;
+		}
+		parser->state = JSON_STRING;
+		uint32_t cp = parser->codepoint;
+		if (cp >= 0xD800 && cp < 0xDC00) {
+			parser->high_surrogate = cp;
+			return true;
+		}
+		if (cp >= 0xDC00 && cp < 0xE000 && parser->high_surrogate) {
+			cp = 0x10000 + ((parser->high_surrogate - 0xD800) << 10) +
+				(cp - 0xDC00);
+		}
+		parser->high_surrogate = 0;
+		return push_utf8(parser, cp);
+	default:
+		break;
+	}
+
+	if (is_space(c)) {
+		return true;
+	}
+
+	switch (parser->state) {
+	case JSON_VALUE:
+		return parse_value_start(parser, c);
+	case JSON_VALUE_OR_ARRAY_END:
+		if (c == ']') {
+			EMIT(parser, array_end);
+			return pop_container(parser, '[');
+		}
+		return parse_value_start(parser, c);
+	case JSON_KEY_OR_OBJECT_END:
+		if (c == '}') {
+			EMIT(parser, object_end);
+			return pop_container(parser, '{');
+		}
+		// fallthrough
+	case JSON_KEY:
+		if (c != '"') {
+			return false;
+		}
+		parser->in_key = true;
+		parser->state = JSON_STRING;
+		return true;
+	case JSON_COLON:
+		if (c != ':') {
+			return false;
+		}
+		parser->state = JSON_VALUE;
+		return true;
+	case JSON_AFTER_VALUE:
+		if (parser->depth == 0) {
+			// another top-level value
+			return parse_value_start(parser, c);
+		}
+		char container = parser->stack[parser->depth - 1];
+		if (c == ',') {
+			parser->state = container == '{' ? JSON_KEY : JSON_VALUE;
+			return true;
+		} else if (c == '}' && container == '{') {
+			EMIT(parser, object_end);
+			return pop_container(parser, '{');
+		} else if (c == ']' && container == '[') {
+			EMIT(parser, array_end);
+			return pop_container(parser, '[');
+		}
+		return false;
+	default:
+		return false;
+	}
+}
+
+void json_parser_init(struct json_parser *parser,
+		const struct json_callbacks *callbacks, void *data) {
+	*parser = (struct json_parser){
+		.callbacks = callbacks,
+		.data = data,
+		.state = JSON_VALUE,
+	};
+}
+
+bool json_parser_feed(struct json_parser *parser, const char *buf, size_t len) {
+	for (size_t i = 0; i < len && !parser->error; i++) {
+		if (!parse_char(parser, buf[i])) {
+			parser->error = true;
+		}
+	}
+	return !parser->error;
+}
+
+bool json_parser_finish(struct json_parser *parser) {
+	// flush a trailing top-level number or literal
+	if (!parser->error && (parser->state == JSON_NUMBER ||
+			parser->state == JSON_LITERAL)) {
+		parser->error = !parse_char(parser, ' ');
+	}
+	return !parser->error && parser->depth == 0 &&
+		(parser->state == JSON_AFTER_VALUE || parser->state == JSON_VALUE);
+}
+
+void json_parser_destroy(struct json_parser *parser) {
+	free(parser->stack);
+	free(parser->token);
+}
@@ -0,0 +1,232 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "keymap.h"
+#include "slurp.h"
+
+#define CACHE_MAGIC "slurpkm1"
+
+struct keymap_cache_header {
+	char magic[8];
+	uint64_t hash;
+	uint64_t size;
+	uint32_t min_keycode;
+	uint32_t len;
+};
+
+static uint64_t hash_buffer(const char *buffer, size_t size) {
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= (unsigned char)buffer[i];
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}
+
+static bool get_cache_path(char *path, size_t len, uint64_t hash) {
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+	if (dir == NULL || dir[0] == '\0') {
+		return false;
+	}
+	int n = snprintf(path, len, "%s/slurp-keymap-%016" PRIx64, dir, hash);
+	return n > 0 && (size_t)n < len;
+}
+
+static bool read_full(int fd, void *data, size_t len) {
+	char *p = data;
+	while (len > 0) {
+		ssize_t n = read(fd, p, len);
+		if (n <= 0) {
+			return false;
+		}
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+static bool load_cache(struct slurp_keymap *keymap) {
+	char path[4096];
+	if (!get_cache_path(path, sizeof(path), keymap->hash)) {
+		return false;
+	}
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct keymap_cache_header header;
+	bool ok = read_full(fd, &header, sizeof(header)) &&
+		memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) == 0 &&
+		header.hash == keymap->hash && header.size == keymap->size &&
+		header.len <= 0x10000;
+	if (ok) {
+		keymap->keysyms = calloc(header.len, sizeof(*keymap->keysyms));
+		ok = keymap->keysyms != NULL && read_full(fd, keymap->keysyms,
+			header.len * sizeof(*keymap->keysyms));
+	}
+	close(fd);
+
+	if (!ok) {
+		free(keymap->keysyms);
+		keymap->keysyms = NULL;
+		return false;
+	}
+	keymap->min_keycode = header.min_keycode;
+	keymap->len = header.len;
+	return true;
+}
+
+static void save_cache(const struct slurp_keymap *keymap) {
+	char path[4096], tmp_path[4096 + 16];
+	if (!get_cache_path(path, sizeof(path), keymap->hash)) {
+		return;
+	}
+	snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, (int)getpid());
+
+	int fd = open(tmp_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		return;
+	}
+	struct keymap_cache_header header = {
+		.hash = keymap->hash,
+		.size = keymap->size,
+		.min_keycode = keymap->min_keycode,
+		.len = keymap->len,
+	};
+	memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+	size_t table_size = keymap->len * sizeof(*keymap->keysyms);
+	bool ok = write(fd, &header, sizeof(header)) == sizeof(header) &&
+		write(fd, keymap->keysyms, table_size) == (ssize_t)table_size;
+	close(fd);
+
+	// rename atomically so that concurrent runs never see a partial file
+	if (!ok || rename(tmp_path, path) != 0) {
+		unlink(tmp_path);
+	}
+}
+
+static bool fill_keysyms(struct slurp_keymap *keymap) {
+	xkb_keycode_t min = xkb_keymap_min_keycode(keymap->xkb_keymap);
+	xkb_keycode_t max = xkb_keymap_max_keycode(keymap->xkb_keymap);
+	keymap->min_keycode = min;
+	keymap->len = max >= min ? max - min + 1 : 0;
+	keymap->keysyms = calloc(keymap->len, sizeof(*keymap->keysyms));
+	if (keymap->keysyms == NULL && keymap->len > 0) {
+		return false;
+	}
+
+	// a fresh state has no modifiers active
+	struct xkb_state *xkb_state = xkb_state_new(keymap->xkb_keymap);
+	if (xkb_state == NULL) {
+		return false;
+	}
+	for (uint32_t i = 0; i < keymap->len; i++) {
+		keymap->keysyms[i] = xkb_state_key_get_one_sym(xkb_state, min + i);
+	}
+	xkb_state_unref(xkb_state);
+	return true;
+}
+
+static struct xkb_context *get_xkb_context(struct slurp_state *state) {
+	if (state->xkb_context == NULL) {
+		state->xkb_context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+		if (state->xkb_context == NULL) {
+			fprintf(stderr, "xkb_context_new failed\n");
+		}
+	}
+	return state->xkb_context;
+}
+
+static struct slurp_keymap *create_keymap(struct slurp_state *state,
+		struct xkb_keymap *xkb_keymap) {
+	struct slurp_keymap *keymap = calloc(1, sizeof(*keymap));
+	if (keymap == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		xkb_keymap_unref(xkb_keymap);
+		return NULL;
+	}
+	wl_list_insert(&state->keymaps, &keymap->link);
+	keymap->xkb_keymap = xkb_keymap;
+	if (xkb_keymap != NULL && !fill_keysyms(keymap)) {
+		fprintf(stderr, "allocation failed\n");
+		keymap_destroy(keymap);
+		return NULL;
+	}
+	return keymap;
+}
+
+struct slurp_keymap *keymap_from_buffer(struct slurp_state *state,
+		const char *buffer, size_t size) {
+	uint64_t hash = hash_buffer(buffer, size);
+
+	// seats usually share the same keymap
+	struct slurp_keymap *keymap;
+	wl_list_for_each(keymap, &state->keymaps, link) {
+		if (keymap->hash == hash && keymap->size == size) {
+			return keymap;
+		}
+	}
+
+	keymap = create_keymap(state, NULL);
+	if (keymap == NULL) {
+		return NULL;
+	}
+	keymap->hash = hash;
+	keymap->size = size;
+	if (load_cache(keymap)) {
+		return keymap;
+	}
+
+	struct xkb_context *xkb_context = get_xkb_context(state);
+	if (xkb_context != NULL) {
+		keymap->xkb_keymap = xkb_keymap_new_from_buffer(xkb_context,
+			buffer, size, XKB_KEYMAP_FORMAT_TEXT_V1,
+			XKB_KEYMAP_COMPILE_NO_FLAGS);
+	}
+	if (keymap->xkb_keymap == NULL || !fill_keysyms(keymap)) {
+		fprintf(stderr, "failed to compile keymap\n");
+		keymap_destroy(keymap);
+		return NULL;
+	}
+	save_cache(keymap);
+	return keymap;
+}
+
+struct slurp_keymap *keymap_from_names(struct slurp_state *state) {
+	struct xkb_context *xkb_context = get_xkb_context(state);
+	if (xkb_context == NULL) {
+		return NULL;
+	}
+	struct xkb_keymap *xkb_keymap = xkb_keymap_new_from_names(xkb_context,
+		NULL, XKB_KEYMAP_COMPILE_NO_FLAGS);
+	if (xkb_keymap == NULL) {
+		fprintf(stderr, "failed to compile keymap\n");
+		return NULL;
+	}
+	return create_keymap(state, xkb_keymap);
+}
+
+xkb_keysym_t keymap_get_keysym(const struct slurp_keymap *keymap,
+		xkb_keycode_t keycode) {
+	if (keycode < keymap->min_keycode ||
+			keycode - keymap->min_keycode >= keymap->len) {
+		return XKB_KEY_NoSymbol;
+	}
+	return keymap->keysyms[keycode - keymap->min_keycode];
+}
+
+void keymap_destroy(struct slurp_keymap *keymap) {
+	wl_list_remove(&keymap->link);
+	xkb_keymap_unref(keymap->xkb_keymap);
+	free(keymap->keysyms);
+	free(keymap);
+}
@@ -1,23 +1,37 @@
 #define _POSIX_C_SOURCE 200809L
 
-#include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include "alloc-stats.h"
+#include "capture.h"
+#include "control.h"
+#include "format.h"
+#include "frame-stats.h"
+#include "hint.h"
+#include "json-input.h"
+#include "selection.h"
+#include "stream.h"
 #include "slurp.h"
+#include "sway-ipc.h"
 
 #define BG_COLOR 0xFFFFFF40
 #define BORDER_COLOR 0x000000FF
 #define SELECTION_COLOR 0x00000000
 #define FONT_FAMILY "sans-serif"
+#define RECLAIM_DELAY 1000
 
 static const char usage[] =
 	"Usage: slurp [options...]\n"
 	"\n"
 	"  -h           Show help message and quit.\n"
 	"  -d           Display dimensions of selection.\n"
+	"  -l           Display labels of predefined rectangles.\n"
 	"  -b #rrggbbaa Set background color.\n"
 	"  -c #rrggbbaa Set border color.\n"
 	"  -s #rrggbbaa Set selection color.\n"
@@ -25,14 +39,26 @@ static const char usage[] =
 	"  -F s         Set the font family for the dimensions.\n"
 	"  -w n         Set border weight.\n"
 	"  -f s         Set output format.\n"
+	"  -J           Print the result as JSON.\n"
+	"  -S fd        Write the selection to fd while it changes.\n"
+	"  -U fd        Read predefined box updates from fd while selecting.\n"
+	"  -C fmt       Capture the selection and print it as ppm, png or qoi.\n"
+	"  -R file      Record the input to file, see slurp-replay.\n"
+	"  -T fd        Write frame statistics to fd on exit.\n"
+	"  -Q ms        Free buffers unused for ms milliseconds, 0 never.\n"
 	"  -o           Select a display output.\n"
+	"  -O names     Only show the overlay on the given outputs.\n"
+	"  -P           Only show the overlay on the output under the pointer.\n"
+	"  -G geometry  Print the given geometry without selecting anything.\n"
 	"  -p           Select a single point.\n"
 	"  -r           Restrict selection to predefined boxes.\n"
-	"  -a w:h       Force aspect ratio.\n";
-
-static int min(int a, int b) {
-	return (a < b) ? a : b;
-}
+	"  -H           Pick predefined boxes by typing their hints.\n"
+	"  -W           Use the visible Sway windows as predefined boxes.\n"
+	"  -a w:h       Force aspect ratio.\n"
+	"  -e n         Snap selection corners to edges within n pixels.\n"
+	"  -j           Read predefined boxes from standard input as JSON.\n"
+	"  -K f=path    Set the key path of a JSON box field (x, y, width,\n"
+	"               height or label).\n";
 
 static uint32_t parse_color(const char *color) {
 	if (color[0] == '#') {
@@ -52,80 +78,9 @@ static uint32_t parse_color(const char *color) {
 	return res;
 }
 
-static void print_output_name(FILE *stream, const struct slurp_box *result, struct wl_list *outputs) {
-	struct slurp_output *output = slurp_output_from_box(result, outputs);
-	if (output) {
-		struct slurp_box *geometry = &output->logical_geometry;
-		if (geometry->label) {
-			fprintf(stream, "%s", geometry->label);
-			return;
-		}
-	}
-	fprintf(stream, "<unknown>");
-}
-
-static void print_formatted_result(FILE *stream, struct slurp_state *state , const char *format) {
-	struct slurp_output *output = slurp_output_from_box(&state->result, &state->outputs);
-	for (size_t i = 0; format[i] != '\0'; i++) {
-		char c = format[i];
-		if (c == '%') {
-			char next = format[i + 1];
-
-			i++; // Skip the next character (x, y, w or h)
-			switch (next) {
-			case 'x':
-				fprintf(stream, "%d", state->result.x);
-				continue;
-			case 'y':
-				fprintf(stream, "%d", state->result.y);
-				continue;
-			case 'w':
-				fprintf(stream, "%d", state->result.width);
-				continue;
-			case 'h':
-				fprintf(stream, "%d", state->result.height);
-				continue;
-			case 'X':
-				assert(output);
-				fprintf(stream, "%d", state->result.x - output->logical_geometry.x);
-				continue;
-			case 'Y':
-				assert(output);
-				fprintf(stream, "%d", state->result.y - output->logical_geometry.y);
-				continue;
-			case 'W':
-				assert(output);
-				fprintf(stream, "%d", min(state->result.width, output->logical_geometry.x + output->logical_geometry.width - state->result.x));
-				continue;
-			case 'H':
-				assert(output);
-				fprintf(stream, "%d", min(state->result.height, output->logical_geometry.y + output->logical_geometry.height - state->result.y));
-				continue;
-			case 'l':
-				if (state->result.label) {
-					fprintf(stream, "%s", state->result.label);
-				}
-				continue;
-			case 'o':
-				print_output_name(stream, &state->result, &state->outputs);
-				continue;
-			default:
-				// If no case was executed, revert i back - we don't need to
-				// skip the next character.
-				i--;
-			}
-		}
-		fprintf(stream, "%c", c);
-	}
-}
-
 int main(int argc, char *argv[]) {
 	int status = EXIT_SUCCESS;
 
-	char *result_str = 0;
-	size_t length;
-	FILE *stream = open_memstream(&result_str, &length);
-
 	struct slurp_state state = {
 		.colors = {
 			.background = BG_COLOR,
@@ -135,19 +90,35 @@ int main(int argc, char *argv[]) {
 		},
 		.border_weight = 2,
 		.display_dimensions = false,
+		.display_labels = false,
 		.restrict_selection = false,
 		.fixed_aspect_ratio = false,
 		.aspect_ratio = 0,
 		.font_family = FONT_FAMILY,
 		.cursor_size = 24,
 		.output_boxes = false,
+		.reclaim_delay = RECLAIM_DELAY,
 	};
 
 	int opt;
 	char *format = "%x,%y %wx%h\n";
+	bool json = false;
+	bool capture = false;
+	bool sway_windows = false;
+	bool json_input = false;
+	int stream_fd = -1;
+	const char *record_path = NULL;
+	int stats_fd = -1;
+	int control_fd = -1;
+	bool hint_mode = false;
+	bool resolve = false;
+	struct slurp_box resolve_box = {0};
+	struct json_input_paths json_paths;
+	json_input_paths_init(&json_paths);
+	enum capture_format capture_format = CAPTURE_FORMAT_PPM;
 	// bool output_boxes = false;
 	int w, h;
-	while ((opt = getopt(argc, argv, "hdb:c:s:B:w:proa:f:F:")) != -1) {
+	while ((opt = getopt(argc, argv, "hdlb:c:s:B:w:proO:PG:Wa:e:jK:f:JS:U:C:F:R:T:Q:H")) != -1) {
 		switch (opt) {
 		case 'h':
 			printf("%s", usage);
@@ -155,6 +126,9 @@ int main(int argc, char *argv[]) {
 		case 'd':
 			state.display_dimensions = true;
 			break;
+		case 'l':
+			state.display_labels = true;
+			break;
 		case 'b':
 			state.colors.background = parse_color(optarg);
 			break;
@@ -170,9 +144,69 @@ int main(int argc, char *argv[]) {
 		case 'f':
 			format = optarg;
 			break;
+		case 'J':
+			json = true;
+			break;
+		case 'S': {
+			errno = 0;
+			char *endptr;
+			stream_fd = strtol(optarg, &endptr, 10);
+			if (*endptr || errno || stream_fd < 0) {
+				fprintf(stderr, "Error: expected file descriptor for -S\n");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		}
+		case 'U': {
+			errno = 0;
+			char *endptr;
+			control_fd = strtol(optarg, &endptr, 10);
+			if (*endptr || errno || control_fd < 0) {
+				fprintf(stderr, "Error: expected file descriptor for -U\n");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		}
+		case 'C':
+			if (strcmp(optarg, "ppm") == 0) {
+				capture_format = CAPTURE_FORMAT_PPM;
+			} else if (strcmp(optarg, "png") == 0) {
+				capture_format = CAPTURE_FORMAT_PNG;
+			} else if (strcmp(optarg, "qoi") == 0) {
+				capture_format = CAPTURE_FORMAT_QOI;
+			} else {
+				fprintf(stderr, "invalid capture format: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			capture = true;
+			break;
 		case 'F':
 			state.font_family = optarg;
 			break;
+		case 'R':
+			record_path = optarg;
+			break;
+		case 'T': {
+			errno = 0;
+			char *endptr;
+			stats_fd = strtol(optarg, &endptr, 10);
+			if (*endptr || errno || stats_fd < 0) {
+				fprintf(stderr, "Error: expected file descriptor for -T\n");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		}
+		case 'Q': {
+			errno = 0;
+			char *endptr;
+			long delay = strtol(optarg, &endptr, 10);
+			if (*endptr || errno || delay < 0 || delay > INT_MAX) {
+				fprintf(stderr, "Error: expected non-negative numeric argument for -Q\n");
+				exit(EXIT_FAILURE);
+			}
+			state.reclaim_delay = delay;
+			break;
+		}
 		case 'w': {
 			errno = 0;
 			char *endptr;
@@ -189,9 +223,30 @@ int main(int argc, char *argv[]) {
 		case 'o':
 			state.output_boxes = true;
 			break;
+		case 'O':
+			state.output_names = optarg;
+			break;
+		case 'P':
+			state.pointer_output = true;
+			break;
+		case 'G':
+			if (sscanf(optarg, "%d,%d %dx%d", &resolve_box.x, &resolve_box.y,
+					&resolve_box.width, &resolve_box.height) != 4 ||
+					resolve_box.width <= 0 || resolve_box.height <= 0) {
+				fprintf(stderr, "invalid geometry: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			resolve = true;
+			break;
 		case 'r':
 			state.restrict_selection = true;
 			break;
+		case 'H':
+			hint_mode = true;
+			break;
+		case 'W':
+			sway_windows = true;
+			break;
 		case 'a':
 			if (sscanf(optarg, "%d:%d", &w, &h) != 2) {
 				fprintf(stderr, "invalid aspect ratio\n");
@@ -204,6 +259,25 @@ int main(int argc, char *argv[]) {
 			state.fixed_aspect_ratio = true;
 			state.aspect_ratio = (double) h / w;
 			break;
+		case 'e': {
+			errno = 0;
+			char *endptr;
+			state.snap_threshold = strtol(optarg, &endptr, 10);
+			if (*endptr || errno || state.snap_threshold < 0) {
+				fprintf(stderr, "Error: expected non-negative numeric argument for -e\n");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		}
+		case 'j':
+			json_input = true;
+			break;
+		case 'K':
+			if (!json_input_paths_set(&json_paths, optarg)) {
+				fprintf(stderr, "invalid JSON key path: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
 		default:
 			printf("%s", usage);
 			return EXIT_FAILURE;
@@ -214,6 +288,18 @@ int main(int argc, char *argv[]) {
 		fprintf(stderr, "-p and -r cannot be used together\n");
 		return EXIT_FAILURE;
 	}
+	if (resolve && (sway_windows || state.pointer_output)) {
+		fprintf(stderr, "-G cannot be used with -W or -P\n");
+		return EXIT_FAILURE;
+	}
+	if (state.output_names != NULL && state.pointer_output) {
+		fprintf(stderr, "-O and -P cannot be used together\n");
+		return EXIT_FAILURE;
+	}
+	if (json_input && control_fd == STDIN_FILENO) {
+		fprintf(stderr, "-j and -U 0 cannot be used together\n");
+		return EXIT_FAILURE;
+	}
 
 	state.cursor_theme = getenv("XCURSOR_THEME");
 	const char *cursor_size_str = getenv("XCURSOR_SIZE");
@@ -227,9 +313,69 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
+	struct format result_format;
+	if (json) {
+		format_init_json(&result_format);
+	} else if (!format_compile(&result_format, format)) {
+		fprintf(stderr, "allocation failed\n");
+		return EXIT_FAILURE;
+	}
+
 	slurp_state_init(&state);
 
-	if (!isatty(STDIN_FILENO) && !state.single_point) {
+	struct slurp_hints hints = {0};
+	if (hint_mode) {
+		state.hints = &hints;
+	}
+
+	struct slurp_stream stream;
+	if (stream_fd >= 0) {
+		if (!stream_init(&stream, stream_fd, &result_format)) {
+			fprintf(stderr, "invalid file descriptor for -S: %d\n", stream_fd);
+			return EXIT_FAILURE;
+		}
+		state.stream = &stream;
+		// a reader going away only ends the stream
+		signal(SIGPIPE, SIG_IGN);
+	}
+
+	struct slurp_control control;
+	if (control_fd >= 0 && !resolve) {
+		if (!control_init(&control, control_fd)) {
+			fprintf(stderr, "invalid file descriptor for -U: %d\n", control_fd);
+			return EXIT_FAILURE;
+		}
+		state.control = &control;
+	}
+
+	if (stats_fd >= 0) {
+		if (fcntl(stats_fd, F_GETFD) < 0) {
+			fprintf(stderr, "invalid file descriptor for -T: %d\n", stats_fd);
+			return EXIT_FAILURE;
+		}
+		frame_stats_enable();
+	}
+
+	if (record_path != NULL && !resolve &&
+			!selection_record_open(&state, record_path)) {
+		fprintf(stderr, "failed to open %s: %s\n", record_path, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	if (sway_windows && !sway_ipc_request_tree(&state)) {
+		fprintf(stderr, "%s\n", state.error);
+		return EXIT_FAILURE;
+	}
+
+	if (resolve) {
+		// predefined boxes are not used
+	} else if (json_input && !state.single_point) {
+		if (!json_input_read(&state, &json_paths, STDIN_FILENO)) {
+			fprintf(stderr, "invalid JSON input\n");
+			return EXIT_FAILURE;
+		}
+	} else if (!isatty(STDIN_FILENO) && !state.single_point &&
+			control_fd != STDIN_FILENO) {
 		char *line = NULL;
 		size_t line_size = 0;
 		while (getline(&line, &line_size, stdin) >= 0) {
@@ -245,7 +391,21 @@ int main(int argc, char *argv[]) {
 		free(line);
 	}
 
-	status = slurp_select(&state);
+	if (resolve) {
+		status = slurp_resolve(&state, &resolve_box);
+	} else {
+		status = slurp_select(&state);
+	}
+	if (state.stream != NULL) {
+		stream_finish(state.stream);
+	}
+	if (state.control != NULL) {
+		control_finish(state.control);
+	}
+	selection_record_close(&state);
+	if (stats_fd >= 0) {
+		frame_stats_print(&state, stats_fd);
+	}
 	if (status != EXIT_SUCCESS) {
 		if (state.error != NULL) {
 			fprintf(stderr, "%s\n", state.error);
@@ -258,17 +418,27 @@ int main(int argc, char *argv[]) {
 	if (state.result.width == 0 && state.result.height == 0) {
 		fprintf(stderr, "selection cancelled\n");
 		status = EXIT_FAILURE;
+	} else if (capture) {
+		status = slurp_capture(&state, capture_format, stdout);
+		if (status != EXIT_SUCCESS) {
+			fprintf(stderr, "%s\n", state.error);
+		}
 	} else {
-		print_formatted_result(stream, &state, format);
-		fclose(stream);
+		size_t length;
+		const char *result_str = format_render(&result_format, &state,
+			&state.result, &length);
+		fwrite(result_str, 1, length, stdout);
+		fflush(stdout);
 	}
 
-	if (result_str) {
-		printf("%s", result_str);
-		free(result_str);
-	}
+	alloc_stats_print(stderr);
 
+	// With fast-exit, the overlay is already gone and the kernel reclaims the
+	// rest faster than we could free it
+#ifndef SLURP_FAST_EXIT
+	format_finish(&result_format);
 	slurp_destroy(&state);
+#endif
 
 	return status;
 }
@@ -0,0 +1,261 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "output-index.h"
+#include "slurp.h"
+
+// The output edges split the layout into a grid, every cell has a bit set
+// for each output covering it. Lookups are a binary search per axis, and a
+// box only visits the cells it covers. The grid is rebuilt on the first
+// lookup after an output changes.
+
+static int compare_int32(const void *a, const void *b) {
+	int32_t x = *(const int32_t *)a, y = *(const int32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static size_t sort_edges(int32_t *edges, size_t len) {
+	if (len == 0) {
+		return 0;
+	}
+	qsort(edges, len, sizeof(*edges), compare_int32);
+	size_t n = 1;
+	for (size_t i = 1; i < len; i++) {
+		if (edges[i] != edges[n - 1]) {
+			edges[n++] = edges[i];
+		}
+	}
+	return n;
+}
+
+// index of the first edge >= v
+static size_t lower_bound(const int32_t *edges, size_t len, int32_t v) {
+	size_t lo = 0, hi = len;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (edges[mid] < v) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+// index of the first edge > v
+static size_t upper_bound(const int32_t *edges, size_t len, int32_t v) {
+	size_t lo = 0, hi = len;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (edges[mid] <= v) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static void index_clear(struct slurp_output_index *index) {
+	free(index->outputs);
+	free(index->xs);
+	free(index->ys);
+	free(index->cells);
+	free(index->mask);
+	memset(index, 0, sizeof(*index));
+}
+
+static bool output_is_indexed(struct slurp_output *output) {
+	const struct slurp_box *g = &output->logical_geometry;
+	return output->wl_output_done &&
+		(output->xdg_output == NULL || output->xdg_output_done) &&
+		g->width > 0 && g->height > 0;
+}
+
+static uint64_t *cell_mask(struct slurp_output_index *index, size_t ix,
+		size_t iy) {
+	return &index->cells[(iy * (index->xs_len - 1) + ix) * index->words];
+}
+
+static bool index_build(struct slurp_state *state) {
+	struct slurp_output_index *index = &state->output_index;
+	index_clear(index);
+
+	size_t len = 0;
+	struct slurp_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		len += output_is_indexed(output);
+	}
+	index->valid = true;
+	if (len == 0) {
+		return true;
+	}
+
+	index->words = (len + 63) / 64;
+	index->outputs = calloc(len, sizeof(*index->outputs));
+	index->xs = calloc(2 * len, sizeof(*index->xs));
+	index->ys = calloc(2 * len, sizeof(*index->ys));
+	index->mask = calloc(index->words, sizeof(*index->mask));
+	if (index->outputs == NULL || index->xs == NULL || index->ys == NULL ||
+			index->mask == NULL) {
+		goto error_alloc;
+	}
+
+	wl_list_for_each(output, &state->outputs, link) {
+		if (!output_is_indexed(output)) {
+			continue;
+		}
+		const struct slurp_box *g = &output->logical_geometry;
+		index->xs[2 * index->len] = g->x;
+		index->xs[2 * index->len + 1] = g->x + g->width;
+		index->ys[2 * index->len] = g->y;
+		index->ys[2 * index->len + 1] = g->y + g->height;
+		index->outputs[index->len++] = output;
+	}
+	index->xs_len = sort_edges(index->xs, 2 * len);
+	index->ys_len = sort_edges(index->ys, 2 * len);
+
+	size_t cells = (index->xs_len - 1) * (index->ys_len - 1);
+	index->cells = calloc(cells * index->words, sizeof(*index->cells));
+	if (index->cells == NULL) {
+		goto error_alloc;
+	}
+	for (size_t i = 0; i < index->len; i++) {
+		const struct slurp_box *g = &index->outputs[i]->logical_geometry;
+		size_t x0 = lower_bound(index->xs, index->xs_len, g->x);
+		size_t x1 = lower_bound(index->xs, index->xs_len, g->x + g->width);
+		size_t y0 = lower_bound(index->ys, index->ys_len, g->y);
+		size_t y1 = lower_bound(index->ys, index->ys_len, g->y + g->height);
+		for (size_t iy = y0; iy < y1; iy++) {
+			for (size_t ix = x0; ix < x1; ix++) {
+				cell_mask(index, ix, iy)[i / 64] |= UINT64_C(1) << (i % 64);
+			}
+		}
+	}
+	return true;
+
+error_alloc:
+	fprintf(stderr, "allocation failed\n");
+	index_clear(index);
+	return false;
+}
+
+static struct slurp_output_index *get_index(struct slurp_state *state) {
+	struct slurp_output_index *index = &state->output_index;
+	if (!index->valid && !index_build(state)) {
+		return NULL;
+	}
+	return index;
+}
+
+void output_index_invalidate(struct slurp_state *state) {
+	state->output_index.valid = false;
+}
+
+void output_index_finish(struct slurp_state *state) {
+	index_clear(&state->output_index);
+}
+
+// ORs the cells covered by the box into the index mask
+static void add_box_cells(struct slurp_output_index *index,
+		const struct slurp_box *box) {
+	if (index->len == 0 || box->width <= 0 || box->height <= 0) {
+		return;
+	}
+	// cell i spans [xs[i], xs[i + 1])
+	size_t x0 = upper_bound(index->xs, index->xs_len, box->x);
+	size_t x1 = lower_bound(index->xs, index->xs_len, box->x + box->width);
+	size_t y0 = upper_bound(index->ys, index->ys_len, box->y);
+	size_t y1 = lower_bound(index->ys, index->ys_len, box->y + box->height);
+	x0 = x0 > 0 ? x0 - 1 : 0;
+	y0 = y0 > 0 ? y0 - 1 : 0;
+	if (x1 > index->xs_len - 1) {
+		x1 = index->xs_len - 1;
+	}
+	if (y1 > index->ys_len - 1) {
+		y1 = index->ys_len - 1;
+	}
+	for (size_t iy = y0; iy < y1; iy++) {
+		for (size_t ix = x0; ix < x1; ix++) {
+			const uint64_t *cell = cell_mask(index, ix, iy);
+			for (size_t w = 0; w < index->words; w++) {
+				index->mask[w] |= cell[w];
+			}
+		}
+	}
+}
+
+void output_index_for_each(struct slurp_state *state,
+		const struct slurp_box *boxes, size_t len,
+		void (*fn)(struct slurp_output *output, void *data), void *data) {
+	struct slurp_output_index *index = get_index(state);
+	if (index == NULL || index->len == 0) {
+		return;
+	}
+	memset(index->mask, 0, index->words * sizeof(*index->mask));
+	for (size_t i = 0; i < len; i++) {
+		add_box_cells(index, &boxes[i]);
+	}
+	for (size_t w = 0; w < index->words; w++) {
+		uint64_t bits = index->mask[w];
+		while (bits != 0) {
+			fn(index->outputs[w * 64 + __builtin_ctzll(bits)], data);
+			bits &= bits - 1;
+		}
+	}
+}
+
+struct slurp_output *output_index_at(struct slurp_state *state,
+		int32_t x, int32_t y) {
+	struct slurp_output_index *index = get_index(state);
+	if (index == NULL || index->len == 0) {
+		return NULL;
+	}
+	size_t ix = upper_bound(index->xs, index->xs_len, x);
+	size_t iy = upper_bound(index->ys, index->ys_len, y);
+	if (ix == 0 || ix >= index->xs_len || iy == 0 || iy >= index->ys_len) {
+		return NULL;
+	}
+	// like the list, the first output wins where several overlap
+	const uint64_t *cell = cell_mask(index, ix - 1, iy - 1);
+	for (size_t w = 0; w < index->words; w++) {
+		if (cell[w] != 0) {
+			return index->outputs[w * 64 + __builtin_ctzll(cell[w])];
+		}
+	}
+	return NULL;
+}
+
+struct largest_overlap {
+	const struct slurp_box *box;
+	struct slurp_output *output;
+	int64_t area;
+};
+
+static void find_largest_overlap(struct slurp_output *output, void *data) {
+	struct largest_overlap *overlap = data;
+	const struct slurp_box *a = overlap->box, *g = &output->logical_geometry;
+	int64_t x0 = a->x > g->x ? a->x : g->x;
+	int64_t y0 = a->y > g->y ? a->y : g->y;
+	int64_t x1 = a->x + a->width < g->x + g->width ?
+		a->x + a->width : g->x + g->width;
+	int64_t y1 = a->y + a->height < g->y + g->height ?
+		a->y + a->height : g->y + g->height;
+	int64_t area = (x1 - x0) * (y1 - y0);
+	if (area > overlap->area) {
+		overlap->area = area;
+		overlap->output = output;
+	}
+}
+
+struct slurp_output *output_index_from_box(struct slurp_state *state,
+		const struct slurp_box *box) {
+	struct slurp_output *output = output_index_at(state, box->x, box->y);
+	if (output != NULL) {
+		return output;
+	}
+	struct largest_overlap overlap = { .box = box };
+	output_index_for_each(state, box, 1, find_largest_overlap, &overlap);
+	return overlap.output;
+}
@@ -1,4 +1,5 @@
 #define _POSIX_C_SOURCE 200112L
+#define _DEFAULT_SOURCE
 #include <cairo/cairo.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -9,6 +10,7 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "frame-stats.h"
 #include "pool-buffer.h"
 
 static void randname(char *buf) {
@@ -63,83 +65,185 @@ static const struct wl_buffer_listener buffer_listener = {
 	.release = buffer_handle_release,
 };
 
-static struct pool_buffer *create_buffer(struct wl_shm *shm,
-		struct pool_buffer *buf, int32_t width, int32_t height) {
-	const enum wl_shm_format wl_fmt = WL_SHM_FORMAT_ARGB8888;
-	const cairo_format_t cairo_fmt = CAIRO_FORMAT_ARGB32;
+static bool create_pool(struct wl_shm *shm, struct pool_buffer *buf,
+		size_t size) {
+	int fd = create_shm_file(size);
+	if (fd == -1) {
+		return false;
+	}
 
-	uint32_t stride = cairo_format_stride_for_width(cairo_fmt, width);
-	size_t size = stride * height;
+	// Every buffer gets painted in full, fault all pages in at once
+	int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+	flags |= MAP_POPULATE;
+#endif
+	void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+	if (data == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
 
-	void *data = NULL;
-	if (size > 0) {
-		int fd = create_shm_file(size);
-		if (fd == -1) {
-			return NULL;
-		}
+	buf->pool = wl_shm_create_pool(shm, fd, size);
+	buf->data = data;
+	buf->size = size;
+	close(fd);
+	frame_stats_shm_mapped(size);
+	return true;
+}
 
-		data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-		if (data == MAP_FAILED) {
-			close(fd);
-			return NULL;
+void invalidate_buffer(struct pool_buffer *buffer) {
+	static uint64_t serial = 0;
+	buffer->serial = ++serial;
+}
+
+static struct pool_buffer *create_buffer(struct wl_shm *shm,
+		struct pool_buffer *buf, int32_t width, int32_t height,
+		uint32_t stride, enum wl_shm_format wl_fmt) {
+	size_t size = (size_t)stride * height;
+
+	if (size > 0) {
+		// a shrinking output keeps its mapping
+		if (size > buf->size) {
+			finish_buffer(buf);
+			if (!create_pool(shm, buf, size)) {
+				return NULL;
+			}
 		}
 
-		struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, size);
-		buf->buffer =
-			wl_shm_pool_create_buffer(pool, 0, width, height, stride, wl_fmt);
+		buf->buffer = wl_shm_pool_create_buffer(buf->pool, 0, width, height,
+			stride, wl_fmt);
 		wl_buffer_add_listener(buf->buffer, &buffer_listener, buf);
-		wl_shm_pool_destroy(pool);
-
-		close(fd);
+		frame_stats_buffer_created();
 	}
 
-	buf->data = data;
-	buf->size = size;
 	buf->width = width;
 	buf->height = height;
-	buf->surface = cairo_image_surface_create_for_data(data, cairo_fmt, width,
-		height, stride);
-	buf->cairo = cairo_create(buf->surface);
+	buf->stride = stride;
+	buf->format = wl_fmt;
+	invalidate_buffer(buf);
+
+	// Only formats cairo can draw to get a cairo context
+	if (wl_fmt == WL_SHM_FORMAT_ARGB8888 || wl_fmt == WL_SHM_FORMAT_XRGB8888) {
+		cairo_format_t cairo_fmt = wl_fmt == WL_SHM_FORMAT_ARGB8888 ?
+			CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24;
+		buf->surface = cairo_image_surface_create_for_data(buf->data, cairo_fmt,
+			width, height, stride);
+		buf->cairo = cairo_create(buf->surface);
+	}
 	return buf;
 }
 
-void finish_buffer(struct pool_buffer *buffer) {
+// Destroys the buffer objects but keeps the pool, for reuse with another
+// size.
+static void release_buffer(struct pool_buffer *buffer) {
 	if (buffer->buffer) {
 		wl_buffer_destroy(buffer->buffer);
+		buffer->buffer = NULL;
 	}
 	if (buffer->cairo) {
 		cairo_destroy(buffer->cairo);
+		buffer->cairo = NULL;
 	}
 	if (buffer->surface) {
 		cairo_surface_destroy(buffer->surface);
+		buffer->surface = NULL;
+	}
+	buffer->width = buffer->height = buffer->stride = 0;
+}
+
+void finish_buffer(struct pool_buffer *buffer) {
+	release_buffer(buffer);
+	if (buffer->pool) {
+		wl_shm_pool_destroy(buffer->pool);
 	}
 	if (buffer->data) {
 		munmap(buffer->data, buffer->size);
+		if (!buffer->reclaimed) {
+			frame_stats_shm_unmapped(buffer->size);
+		}
 	}
 	memset(buffer, 0, sizeof(struct pool_buffer));
 }
 
-struct pool_buffer *get_next_buffer(struct wl_shm *shm,
-		struct pool_buffer pool[static 2], uint32_t width, uint32_t height) {
+// Gives the memory of a buffer the compositor doesn't hold back to the
+// system. The contents are lost, the pages are faulted in again as zeros
+// when the buffer is next drawn.
+void reclaim_buffer(struct pool_buffer *buffer) {
+	if (buffer->busy || buffer->data == NULL || buffer->reclaimed) {
+		return;
+	}
+#ifdef MADV_REMOVE
+	// frees the shared memory pages, the pool and wl_buffer stay valid
+	if (madvise(buffer->data, buffer->size, MADV_REMOVE) == 0) {
+		buffer->reclaimed = true;
+		invalidate_buffer(buffer);
+		frame_stats_shm_reclaimed(buffer->size);
+		return;
+	}
+#endif
+	finish_buffer(buffer);
+}
+
+struct pool_buffer *get_next_buffer_format(struct wl_shm *shm,
+		struct pool_buffer pool[static 2], uint32_t width, uint32_t height,
+		uint32_t stride, enum wl_shm_format format) {
 	struct pool_buffer *buffer = NULL;
 	for (size_t i = 0; i < 2; ++i) {
 		if (pool[i].busy) {
 			continue;
 		}
-		buffer = &pool[i];
+		// prefer one whose memory wasn't given back
+		if (buffer == NULL || !pool[i].reclaimed) {
+			buffer = &pool[i];
+		}
 	}
 	if (!buffer) {
 		return NULL;
 	}
+	if (buffer->reclaimed) {
+		buffer->reclaimed = false;
+		frame_stats_shm_restored(buffer->size);
+	}
 
-	if (buffer->width != width || buffer->height != height) {
-		finish_buffer(buffer);
+	if (buffer->width != width || buffer->height != height ||
+			buffer->stride != stride || buffer->format != format) {
+		release_buffer(buffer);
 	}
 
 	if (!buffer->buffer) {
-		if (!create_buffer(shm, buffer, width, height)) {
+		if (!create_buffer(shm, buffer, width, height, stride, format)) {
 			return NULL;
 		}
 	}
 	return buffer;
 }
+
+struct pool_buffer *get_buffer_format(struct wl_shm *shm,
+		struct pool_buffer *buffer, uint32_t width, uint32_t height,
+		uint32_t stride, enum wl_shm_format format) {
+	if (buffer->width != width || buffer->height != height ||
+			buffer->stride != stride || buffer->format != format) {
+		release_buffer(buffer);
+	}
+
+	if (!buffer->buffer) {
+		if (!create_buffer(shm, buffer, width, height, stride, format)) {
+			return NULL;
+		}
+	}
+	return buffer;
+}
+
+struct pool_buffer *get_buffer(struct wl_shm *shm, struct pool_buffer *buffer,
+		uint32_t width, uint32_t height) {
+	uint32_t stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, width);
+	return get_buffer_format(shm, buffer, width, height, stride,
+		WL_SHM_FORMAT_ARGB8888);
+}
+
+struct pool_buffer *get_next_buffer(struct wl_shm *shm,
+		struct pool_buffer pool[static 2], uint32_t width, uint32_t height) {
+	uint32_t stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, width);
+	return get_next_buffer_format(shm, pool, width, height, stride,
+		WL_SHM_FORMAT_ARGB8888);
+}
@@ -1,22 +1,74 @@
 #include <cairo/cairo.h>
+#include <math.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "fill.h"
+#include "hint.h"
 #include "pool-buffer.h"
 #include "render.h"
 #include "slurp.h"
+#include "tile-pool.h"
 
-static void set_source_u32(cairo_t *cairo, uint32_t color) {
-	cairo_set_source_rgba(cairo, (color >> (3 * 8) & 0xFF) / 255.0,
-		(color >> (2 * 8) & 0xFF) / 255.0,
-		(color >> (1 * 8) & 0xFF) / 255.0,
-		(color >> (0 * 8) & 0xFF) / 255.0);
+// Frames are recorded as a list of ops, then replayed on horizontal tiles
+// of the buffer. A tile is only redrawn if the ops touching it differ from
+// the ones the buffer last got there, and only the tiles that differ from
+// the frame shown are damaged.
+#define RENDER_TILE_HEIGHT 128
+// frames with at least this many pixels to redraw are split across threads
+#define RENDER_PARALLEL_PIXELS (1 << 21)
+
+enum render_op_type {
+	RENDER_OP_RECT,
+	RENDER_OP_BORDER,
+	RENDER_OP_GLYPHS,
+};
+
+// One drawing step, in buffer pixels
+struct render_op {
+	enum render_op_type type;
+	int32_t y0, y1; // rows the op may touch
+	uint64_t hash;
+
+	int32_t x, y, width, height, weight;
+	uint32_t color;
+
+	cairo_scaled_font_t *font;
+	size_t glyphs, glyphs_len; // in render_cache::glyphs
+};
+
+struct render_tile {
+	// hash of the ops last drawn, if valid
+	uint64_t hash;
+	bool valid;
+	// text is drawn through a surface covering just the tile
+	cairo_surface_t *surface;
+	cairo_t *cairo;
+	size_t pixels;
+};
+
+// The tiles of one of the output's buffers
+struct render_tiles {
+	uint64_t serial; // see pool_buffer::serial
+	struct render_tile *tiles;
+	size_t len;
+};
+
+// Rectangles are written straight into the buffer, cairo is only used for
+// text. Switch between the two with these so that cairo sees the changes.
+static void begin_fill(struct pool_buffer *buffer, struct fill_target *target) {
+	cairo_surface_flush(buffer->surface);
+	target->data = buffer->data;
+	target->width = buffer->width;
+	target->height = buffer->height;
+	target->stride = cairo_image_surface_get_stride(buffer->surface) /
+		sizeof(uint32_t);
 }
 
-static void draw_rect(cairo_t *cairo, struct slurp_box *box, uint32_t color) {
-	set_source_u32(cairo, color);
-	cairo_rectangle(cairo, box->x, box->y,
-			box->width, box->height);
+static void end_fill(struct pool_buffer *buffer) {
+	cairo_surface_mark_dirty(buffer->surface);
 }
 
 static void box_layout_to_output(struct slurp_box *box, struct slurp_output *output) {
@@ -24,26 +76,792 @@ static void box_layout_to_output(struct slurp_box *box, struct slurp_output *out
 	box->y -= output->logical_geometry.y;
 }
 
-void render(struct slurp_output *output) {
+#define LABEL_FONT_SIZE 12
+#define LABEL_PADDING 4
+#define DIMENSIONS_FONT_SIZE 14
+
+// characters used by the dimensions, in glyph table order
+static const char dimensions_chars[] = "0123456789x";
+#define DIMENSIONS_GLYPHS (sizeof(dimensions_chars) - 1)
+
+struct render_label {
+	const struct slurp_box *box;
+	int32_t x, y; // where the glyphs were laid out, in output coordinates
+	cairo_glyph_t *glyphs;
+	int num_glyphs;
+};
+
+struct render_glyph {
+	unsigned long index;
+	double advance;
+};
+
+// Everything text rendering needs, created once per output and scale so that
+// drawing a frame doesn't allocate. Labels are shaped once, then drawn from
+// the cached glyph runs on every frame.
+struct render_cache {
+	int32_t scale;
+	cairo_pattern_t *text_source;
+
+	cairo_scaled_font_t *font;
+	bool valid;
+	struct render_label *labels;
+	size_t len, cap;
+
+	cairo_scaled_font_t *dimensions_font;
+	struct render_glyph dimensions_glyphs[DIMENSIONS_GLYPHS];
+	// hints use the dimensions font
+	struct render_glyph hint_glyphs[HINT_KEYS_LEN];
+	double hint_descent;
+
+	// the frame being recorded
+	struct render_op *ops;
+	size_t ops_len, ops_cap;
+	cairo_glyph_t *glyphs;
+	size_t glyphs_len, glyphs_cap;
+	bool ops_failed;
+
+	// per tile: the hashes of the frame being drawn and of the one shown,
+	// and the tiles to redraw
+	uint64_t *frame_hashes, *shown_hashes;
+	size_t *redraw;
+	size_t tiles_cap, shown_len;
+	struct render_tiles buffer_tiles[2];
+};
+
+static void label_cache_clear(struct render_cache *cache) {
+	for (size_t i = 0; i < cache->len; i++) {
+		cairo_glyph_free(cache->labels[i].glyphs);
+	}
+	cache->len = 0;
+	cache->valid = false;
+}
+
+static cairo_scaled_font_t *create_font(struct slurp_state *state,
+		double size, int32_t scale) {
+	cairo_font_face_t *face = cairo_toy_font_face_create(state->font_family,
+		CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+	cairo_matrix_t font_matrix, ctm;
+	cairo_matrix_init_scale(&font_matrix, size, size);
+	cairo_matrix_init_scale(&ctm, scale, scale);
+	cairo_font_options_t *options = cairo_font_options_create();
+	cairo_scaled_font_t *font =
+		cairo_scaled_font_create(face, &font_matrix, &ctm, options);
+	cairo_font_options_destroy(options);
+	cairo_font_face_destroy(face);
+	return font;
+}
+
+static void init_glyphs(cairo_scaled_font_t *font, const char *chars,
+		size_t len, struct render_glyph *table) {
+	cairo_glyph_t *glyphs = NULL;
+	int num_glyphs = 0;
+	if (cairo_scaled_font_text_to_glyphs(font, 0, 0, chars, len, &glyphs,
+			&num_glyphs, NULL, NULL, NULL) != CAIRO_STATUS_SUCCESS ||
+			num_glyphs != (int)len) {
+		cairo_glyph_free(glyphs);
+		return;
+	}
+	for (size_t i = 0; i < len; i++) {
+		cairo_text_extents_t extents;
+		cairo_scaled_font_glyph_extents(font, &glyphs[i], 1, &extents);
+		table[i].index = glyphs[i].index;
+		table[i].advance = extents.x_advance;
+	}
+	cairo_glyph_free(glyphs);
+}
+
+static void destroy_fonts(struct render_cache *cache) {
+	label_cache_clear(cache);
+	if (cache->font != NULL) {
+		cairo_scaled_font_destroy(cache->font);
+		cache->font = NULL;
+	}
+	if (cache->dimensions_font != NULL) {
+		cairo_scaled_font_destroy(cache->dimensions_font);
+		cache->dimensions_font = NULL;
+	}
+}
+
+static struct render_cache *get_render_cache(struct slurp_output *output) {
+	struct slurp_state *state = output->state;
+	struct render_cache *cache = output->render_cache;
+	if (cache == NULL) {
+		cache = calloc(1, sizeof(*cache));
+		if (cache == NULL) {
+			fprintf(stderr, "allocation failed\n");
+			return NULL;
+		}
+		uint32_t color = state->colors.border;
+		cache->text_source = cairo_pattern_create_rgba(
+			(color >> (3 * 8) & 0xFF) / 255.0,
+			(color >> (2 * 8) & 0xFF) / 255.0,
+			(color >> (1 * 8) & 0xFF) / 255.0,
+			(color >> (0 * 8) & 0xFF) / 255.0);
+		output->render_cache = cache;
+	}
+	return cache;
+}
+
+// Fonts are only loaded once some text is drawn
+static void load_fonts(struct slurp_output *output,
+		struct render_cache *cache) {
+	struct slurp_state *state = output->state;
+	if (cache->font != NULL && cache->scale != output->scale) {
+		destroy_fonts(cache);
+	}
+	if (cache->font == NULL) {
+		cache->scale = output->scale;
+		cache->font = create_font(state, LABEL_FONT_SIZE, output->scale);
+		cache->dimensions_font =
+			create_font(state, DIMENSIONS_FONT_SIZE, output->scale);
+		init_glyphs(cache->dimensions_font, dimensions_chars,
+			DIMENSIONS_GLYPHS, cache->dimensions_glyphs);
+		init_glyphs(cache->dimensions_font, HINT_KEYS, HINT_KEYS_LEN,
+			cache->hint_glyphs);
+		cairo_font_extents_t extents;
+		cairo_scaled_font_extents(cache->dimensions_font, &extents);
+		cache->hint_descent = extents.descent;
+	}
+}
+
+// box is the choice box, layout the same box in output coordinates
+static bool label_cache_append(struct render_cache *cache,
+		const struct slurp_box *box, const struct slurp_box *layout) {
+	if (cache->len == cache->cap) {
+		size_t cap = cache->cap ? cache->cap * 2 : 16;
+		struct render_label *labels =
+			realloc(cache->labels, cap * sizeof(*labels));
+		if (labels == NULL) {
+			return false;
+		}
+		cache->labels = labels;
+		cache->cap = cap;
+	}
+
+	cairo_font_extents_t extents;
+	cairo_scaled_font_extents(cache->font, &extents);
+
+	struct render_label *label = &cache->labels[cache->len];
+	label->box = box;
+	label->x = layout->x;
+	label->y = layout->y;
+	label->glyphs = NULL;
+	label->num_glyphs = 0;
+	if (cairo_scaled_font_text_to_glyphs(cache->font,
+			layout->x + LABEL_PADDING,
+			layout->y + LABEL_PADDING + extents.ascent,
+			box->label, -1, &label->glyphs, &label->num_glyphs,
+			NULL, NULL, NULL) != CAIRO_STATUS_SUCCESS) {
+		return false;
+	}
+	cache->len++;
+	return true;
+}
+
+static bool label_is_shown(struct slurp_output *output,
+		const struct slurp_box *box) {
+	return box->label != NULL && box->label[0] != '\0' &&
+		slurp_box_intersect(&output->logical_geometry, box);
+}
+
+static void update_labels(struct slurp_output *output,
+		struct render_cache *cache) {
+	if (cache->valid) {
+		return;
+	}
+
+	label_cache_clear(cache);
+	struct slurp_box *choice_box;
+	wl_list_for_each(choice_box, &output->state->boxes, link) {
+		if (!label_is_shown(output, choice_box)) {
+			continue;
+		}
+		struct slurp_box b = *choice_box;
+		box_layout_to_output(&b, output);
+		if (!label_cache_append(cache, choice_box, &b)) {
+			fprintf(stderr, "failed to lay out label: %s\n", b.label);
+		}
+	}
+	cache->valid = true;
+}
+
+void render_invalidate_labels(struct slurp_output *output) {
+	struct render_cache *cache = output->render_cache;
+	if (cache != NULL) {
+		cache->valid = false;
+	}
+}
+
+static struct render_label *find_label(struct render_cache *cache,
+		const struct slurp_box *box) {
+	for (size_t i = 0; i < cache->len; i++) {
+		if (cache->labels[i].box == box) {
+			return &cache->labels[i];
+		}
+	}
+	return NULL;
+}
+
+static void label_cache_remove(struct render_cache *cache,
+		struct render_label *label) {
+	cairo_glyph_free(label->glyphs);
+	size_t i = label - cache->labels;
+	memmove(label, label + 1, (cache->len - i - 1) * sizeof(*label));
+	cache->len--;
+}
+
+// A moved label keeps its glyphs, they are only shifted
+void render_update_label(struct slurp_output *output,
+		const struct slurp_box *box) {
+	struct render_cache *cache = output->render_cache;
+	if (cache == NULL || !cache->valid) {
+		return;
+	}
+	struct render_label *label = find_label(cache, box);
+	if (!label_is_shown(output, box)) {
+		if (label != NULL) {
+			label_cache_remove(cache, label);
+		}
+		return;
+	}
+
+	struct slurp_box b = *box;
+	box_layout_to_output(&b, output);
+	if (label == NULL) {
+		if (!label_cache_append(cache, box, &b)) {
+			fprintf(stderr, "failed to lay out label: %s\n", b.label);
+		}
+		return;
+	}
+	double dx = b.x - label->x, dy = b.y - label->y;
+	for (int i = 0; i < label->num_glyphs; i++) {
+		label->glyphs[i].x += dx;
+		label->glyphs[i].y += dy;
+	}
+	label->x = b.x;
+	label->y = b.y;
+}
+
+void render_remove_label(struct slurp_output *output,
+		const struct slurp_box *box) {
+	struct render_cache *cache = output->render_cache;
+	if (cache == NULL || !cache->valid) {
+		return;
+	}
+	struct render_label *label = find_label(cache, box);
+	if (label != NULL) {
+		label_cache_remove(cache, label);
+	}
+}
+
+void render_damage_all(struct slurp_output *output) {
+	struct render_cache *cache = output->render_cache;
+	if (cache != NULL) {
+		cache->shown_len = 0;
+	}
+}
+
+static void tiles_clear(struct render_tiles *tiles) {
+	for (size_t i = 0; i < tiles->len; i++) {
+		if (tiles->tiles[i].cairo != NULL) {
+			cairo_destroy(tiles->tiles[i].cairo);
+			cairo_surface_destroy(tiles->tiles[i].surface);
+		}
+	}
+	free(tiles->tiles);
+	*tiles = (struct render_tiles){0};
+}
+
+void render_finish(struct slurp_output *output) {
+	struct render_cache *cache = output->render_cache;
+	if (cache == NULL) {
+		return;
+	}
+	destroy_fonts(cache);
+	cairo_pattern_destroy(cache->text_source);
+	free(cache->labels);
+	free(cache->ops);
+	free(cache->glyphs);
+	free(cache->frame_hashes);
+	free(cache->shown_hashes);
+	free(cache->redraw);
+	tiles_clear(&cache->buffer_tiles[0]);
+	tiles_clear(&cache->buffer_tiles[1]);
+	free(cache);
+	output->render_cache = NULL;
+}
+
+static uint64_t hash_u64(uint64_t h, uint64_t v) {
+	// splitmix64's finalizer
+	h ^= v;
+	h ^= h >> 30;
+	h *= 0xBF58476D1CE4E5B9;
+	h ^= h >> 27;
+	h *= 0x94D049BB133111EB;
+	h ^= h >> 31;
+	return h;
+}
+
+static uint64_t hash_double(uint64_t h, double v) {
+	uint64_t bits;
+	memcpy(&bits, &v, sizeof(bits));
+	return hash_u64(h, bits);
+}
+
+static struct render_op *push_op(struct render_cache *cache,
+		enum render_op_type type) {
+	if (cache->ops_len == cache->ops_cap) {
+		size_t cap = cache->ops_cap ? cache->ops_cap * 2 : 64;
+		struct render_op *ops = realloc(cache->ops, cap * sizeof(*ops));
+		if (ops == NULL) {
+			cache->ops_failed = true;
+			return NULL;
+		}
+		cache->ops = ops;
+		cache->ops_cap = cap;
+	}
+	struct render_op *op = &cache->ops[cache->ops_len++];
+	*op = (struct render_op){ .type = type };
+	return op;
+}
+
+static void record_fill(struct render_cache *cache, enum render_op_type type,
+		int32_t x, int32_t y, int32_t width, int32_t height, int32_t weight,
+		uint32_t color) {
+	struct render_op *op = push_op(cache, type);
+	if (op == NULL) {
+		return;
+	}
+	op->x = x;
+	op->y = y;
+	op->width = width;
+	op->height = height;
+	op->weight = weight;
+	op->color = fill_color_from_rgba(color);
+	// see fill_border()
+	op->y0 = y - weight / 2;
+	op->y1 = y + height + weight;
+
+	uint64_t h = hash_u64(type, (uint64_t)(uint32_t)x << 32 | (uint32_t)y);
+	h = hash_u64(h, (uint64_t)(uint32_t)width << 32 | (uint32_t)height);
+	op->hash = hash_u64(h, (uint64_t)(uint32_t)weight << 32 | op->color);
+}
+
+static void draw_rect(struct render_cache *cache, struct slurp_box *box,
+		int32_t scale, uint32_t color) {
+	record_fill(cache, RENDER_OP_RECT, box->x * scale, box->y * scale,
+		box->width * scale, box->height * scale, 0, color);
+}
+
+static void draw_border(struct render_cache *cache, struct slurp_box *box,
+		int32_t scale, int32_t weight, uint32_t color) {
+	if (weight <= 0) {
+		return;
+	}
+	record_fill(cache, RENDER_OP_BORDER, box->x * scale, box->y * scale,
+		box->width * scale, box->height * scale, weight * scale, color);
+}
+
+// Glyph positions are in output-local logical coordinates
+static void draw_glyphs(struct render_cache *cache, cairo_scaled_font_t *font,
+		int32_t scale, const cairo_glyph_t *glyphs, size_t len) {
+	if (len == 0) {
+		return;
+	}
+	if (cache->glyphs_len + len > cache->glyphs_cap) {
+		size_t cap = cache->glyphs_cap ? cache->glyphs_cap : 256;
+		while (cap < cache->glyphs_len + len) {
+			cap *= 2;
+		}
+		cairo_glyph_t *arena = realloc(cache->glyphs, cap * sizeof(*arena));
+		if (arena == NULL) {
+			cache->ops_failed = true;
+			return;
+		}
+		cache->glyphs = arena;
+		cache->glyphs_cap = cap;
+	}
+	struct render_op *op = push_op(cache, RENDER_OP_GLYPHS);
+	if (op == NULL) {
+		return;
+	}
+	op->font = font;
+	op->glyphs = cache->glyphs_len;
+	op->glyphs_len = len;
+	memcpy(&cache->glyphs[cache->glyphs_len], glyphs, len * sizeof(*glyphs));
+	cache->glyphs_len += len;
+
+	// the ink extents, plus a row for antialiasing
+	cairo_text_extents_t extents;
+	cairo_scaled_font_glyph_extents(font, glyphs, len, &extents);
+	double top = glyphs[0].y + extents.y_bearing;
+	op->y0 = (int32_t)floor(top * scale) - 1;
+	op->y1 = (int32_t)ceil((top + extents.height) * scale) + 1;
+
+	uint64_t h = hash_u64(RENDER_OP_GLYPHS, (uintptr_t)font);
+	for (size_t i = 0; i < len; i++) {
+		h = hash_u64(h, glyphs[i].index);
+		h = hash_double(h, glyphs[i].x);
+		h = hash_double(h, glyphs[i].y);
+	}
+	op->hash = h;
+}
+
+static void draw_labels(struct slurp_output *output,
+		struct render_cache *cache) {
+	update_labels(output, cache);
+	for (size_t i = 0; i < cache->len; i++) {
+		draw_glyphs(cache, cache->font, output->scale,
+			cache->labels[i].glyphs, cache->labels[i].num_glyphs);
+	}
+}
+
+static size_t append_dimensions_glyphs(struct render_cache *cache,
+		cairo_glyph_t *glyphs, size_t len, uint32_t value, double *x,
+		double y) {
+	// digits come out in reverse
+	char digits[10];
+	size_t n = 0;
+	do {
+		digits[n++] = value % 10;
+		value /= 10;
+	} while (value > 0);
+	while (n > 0) {
+		struct render_glyph *glyph =
+			&cache->dimensions_glyphs[(int)digits[--n]];
+		glyphs[len++] = (cairo_glyph_t){ glyph->index, *x, y };
+		*x += glyph->advance;
+	}
+	return len;
+}
+
+// Lays out "<width>x<height>" from the cached glyphs, without going through
+// cairo's text API which looks up the font on every call.
+static void draw_dimensions(struct render_cache *cache, int32_t scale,
+		const struct slurp_box *b) {
+	if (cache->dimensions_font == NULL) {
+		return;
+	}
+	cairo_glyph_t glyphs[2 * 10 + 1];
+	double x = b->x + b->width + 10;
+	double y = b->y + b->height + 20;
+	size_t len = append_dimensions_glyphs(cache, glyphs, 0, b->width, &x, y);
+	struct render_glyph *times =
+		&cache->dimensions_glyphs[DIMENSIONS_GLYPHS - 1];
+	glyphs[len++] = (cairo_glyph_t){ times->index, x, y };
+	x += times->advance;
+	len = append_dimensions_glyphs(cache, glyphs, len, b->height, &x, y);
+
+	draw_glyphs(cache, cache->dimensions_font, scale, glyphs, len);
+}
+
+// Draws the hints of the boxes left, at their bottom-left corner
+static void draw_hints(struct slurp_output *output,
+		struct render_cache *cache) {
+	struct slurp_hints *hints = output->state->hints;
+	if (cache->dimensions_font == NULL) {
+		return;
+	}
+	for (size_t i = hints->lo; i < hints->hi; i++) {
+		if (!slurp_box_intersect(&output->logical_geometry,
+				&hints->boxes[i])) {
+			continue;
+		}
+		struct slurp_box b = hints->boxes[i];
+		box_layout_to_output(&b, output);
+
+		uint8_t keys[HINT_MAX_LEN];
+		size_t len = hints_get(hints, i, keys);
+		cairo_glyph_t glyphs[HINT_MAX_LEN];
+		double x = b.x + LABEL_PADDING;
+		double y = b.y + b.height - LABEL_PADDING - cache->hint_descent;
+		for (size_t j = 0; j < len; j++) {
+			struct render_glyph *glyph = &cache->hint_glyphs[keys[j]];
+			glyphs[j] = (cairo_glyph_t){ glyph->index, x, y };
+			x += glyph->advance;
+		}
+		draw_glyphs(cache, cache->dimensions_font, output->scale,
+			glyphs, len);
+	}
+}
+
+size_t render_background(struct slurp_state *state, struct pool_buffer *buffer) {
+	struct fill_target target;
+	begin_fill(buffer, &target);
+	size_t pixels = fill_rect(&target, 0, 0, target.width, target.height,
+		fill_color_from_rgba(state->colors.background));
+	end_fill(buffer);
+	// render() doesn't know about this
+	invalidate_buffer(buffer);
+	return pixels;
+}
+
+struct render_frame {
+	struct slurp_output *output;
+	struct render_cache *cache;
+	struct render_tiles *tiles;
+	struct pool_buffer *buffer;
+};
+
+// Replays the ops touching a tile, may run on any thread
+static void render_tile(void *data, size_t i) {
+	struct render_frame *frame = data;
+	struct render_cache *cache = frame->cache;
+	struct pool_buffer *buffer = frame->buffer;
+	size_t index = cache->redraw[i];
+	struct render_tile *tile = &frame->tiles->tiles[index];
+	int32_t y0 = index * RENDER_TILE_HEIGHT;
+	int32_t y1 = y0 + RENDER_TILE_HEIGHT;
+	if (y1 > (int32_t)buffer->height) {
+		y1 = buffer->height;
+	}
+
+	struct fill_target target = {
+		.data = (uint32_t *)((uint8_t *)buffer->data +
+			(size_t)y0 * buffer->stride),
+		.width = buffer->width,
+		.height = y1 - y0,
+		.stride = buffer->stride / sizeof(uint32_t),
+	};
+	tile->pixels = 0;
+	// whether cairo is drawing, see begin_fill()
+	bool text = false;
+	bool matrix_set = false;
+
+	for (size_t j = 0; j < cache->ops_len; j++) {
+		struct render_op *op = &cache->ops[j];
+		if (op->y1 <= y0 || op->y0 >= y1) {
+			continue;
+		}
+		if (op->type != RENDER_OP_GLYPHS) {
+			if (text) {
+				cairo_surface_flush(tile->surface);
+				text = false;
+			}
+			if (op->type == RENDER_OP_RECT) {
+				tile->pixels += fill_rect(&target, op->x, op->y - y0,
+					op->width, op->height, op->color);
+			} else {
+				tile->pixels += fill_border(&target, op->x, op->y - y0,
+					op->width, op->height, op->weight, op->color);
+			}
+			continue;
+		}
+
+		if (tile->cairo == NULL) {
+			tile->surface = cairo_image_surface_create_for_data(
+				(unsigned char *)target.data, CAIRO_FORMAT_ARGB32,
+				target.width, target.height, buffer->stride);
+			tile->cairo = cairo_create(tile->surface);
+			cairo_set_operator(tile->cairo, CAIRO_OPERATOR_SOURCE);
+		}
+		if (!matrix_set) {
+			int32_t scale = frame->output->scale;
+			cairo_identity_matrix(tile->cairo);
+			cairo_translate(tile->cairo, 0, -y0);
+			cairo_scale(tile->cairo, scale, scale);
+			matrix_set = true;
+		}
+		if (!text) {
+			cairo_surface_mark_dirty(tile->surface);
+			text = true;
+		}
+		cairo_set_scaled_font(tile->cairo, op->font);
+		cairo_set_source(tile->cairo, cache->text_source);
+		cairo_show_glyphs(tile->cairo, &cache->glyphs[op->glyphs],
+			op->glyphs_len);
+	}
+	if (text) {
+		cairo_surface_flush(tile->surface);
+	}
+}
+
+static bool reserve_tiles(struct render_cache *cache, size_t len) {
+	if (len <= cache->tiles_cap) {
+		return true;
+	}
+	uint64_t *frame_hashes =
+		realloc(cache->frame_hashes, len * sizeof(*frame_hashes));
+	if (frame_hashes == NULL) {
+		return false;
+	}
+	cache->frame_hashes = frame_hashes;
+	uint64_t *shown_hashes =
+		realloc(cache->shown_hashes, len * sizeof(*shown_hashes));
+	if (shown_hashes == NULL) {
+		return false;
+	}
+	cache->shown_hashes = shown_hashes;
+	size_t *redraw = realloc(cache->redraw, len * sizeof(*redraw));
+	if (redraw == NULL) {
+		return false;
+	}
+	cache->redraw = redraw;
+	cache->tiles_cap = len;
+	return true;
+}
+
+// Redraws the tiles whose ops changed since the buffer last got them, and
+// sets damage to the rows that differ from the frame shown.
+static size_t draw_tiles(struct slurp_output *output,
+		struct render_cache *cache, struct slurp_box *damage) {
+	struct pool_buffer *buffer = output->current_buffer;
+	size_t len = (buffer->height + RENDER_TILE_HEIGHT - 1) / RENDER_TILE_HEIGHT;
+	if (!reserve_tiles(cache, len)) {
+		fprintf(stderr, "allocation failed\n");
+		return 0;
+	}
+
+	struct render_tiles *tiles =
+		&cache->buffer_tiles[buffer == &output->buffers[1]];
+	if (tiles->serial != buffer->serial || tiles->len != len) {
+		tiles_clear(tiles);
+		tiles->tiles = calloc(len, sizeof(*tiles->tiles));
+		if (tiles->tiles == NULL) {
+			fprintf(stderr, "allocation failed\n");
+			return 0;
+		}
+		tiles->len = len;
+		tiles->serial = buffer->serial;
+	}
+
+	uint64_t seed = hash_u64(buffer->width, output->scale);
+	for (size_t i = 0; i < len; i++) {
+		cache->frame_hashes[i] = seed;
+	}
+	for (size_t j = 0; j < cache->ops_len; j++) {
+		struct render_op *op = &cache->ops[j];
+		if (op->y1 <= 0 || op->y0 >= (int32_t)buffer->height) {
+			continue;
+		}
+		size_t first = op->y0 > 0 ? op->y0 / RENDER_TILE_HEIGHT : 0;
+		size_t last = (op->y1 - 1) / RENDER_TILE_HEIGHT;
+		if (last >= len) {
+			last = len - 1;
+		}
+		for (size_t i = first; i <= last; i++) {
+			cache->frame_hashes[i] = hash_u64(cache->frame_hashes[i], op->hash);
+		}
+	}
+
+	size_t redraw_len = 0;
+	for (size_t i = 0; i < len; i++) {
+		if (cache->ops_failed || !tiles->tiles[i].valid ||
+				tiles->tiles[i].hash != cache->frame_hashes[i]) {
+			cache->redraw[redraw_len++] = i;
+		}
+	}
+
+	struct render_frame frame = {
+		.output = output,
+		.cache = cache,
+		.tiles = tiles,
+		.buffer = buffer,
+	};
+	if (redraw_len > 1 && (size_t)buffer->width * RENDER_TILE_HEIGHT *
+			redraw_len >= RENDER_PARALLEL_PIXELS) {
+		tile_pool_run(render_tile, &frame, redraw_len);
+	} else {
+		for (size_t i = 0; i < redraw_len; i++) {
+			render_tile(&frame, i);
+		}
+	}
+
+	size_t pixels = 0;
+	for (size_t i = 0; i < redraw_len; i++) {
+		struct render_tile *tile = &tiles->tiles[cache->redraw[i]];
+		pixels += tile->pixels;
+		// a frame that couldn't be recorded in full is drawn again
+		tile->valid = !cache->ops_failed;
+		tile->hash = cache->frame_hashes[cache->redraw[i]];
+	}
+
+	size_t first = len, last = 0;
+	for (size_t i = 0; i < len; i++) {
+		if (cache->ops_failed || len != cache->shown_len ||
+				cache->frame_hashes[i] != cache->shown_hashes[i]) {
+			if (first == len) {
+				first = i;
+			}
+			last = i;
+		}
+		cache->shown_hashes[i] = cache->frame_hashes[i];
+	}
+	cache->shown_len = len;
+	if (first < len) {
+		int32_t y0 = first * RENDER_TILE_HEIGHT;
+		int32_t y1 = (last + 1) * RENDER_TILE_HEIGHT;
+		if (y1 > (int32_t)buffer->height) {
+			y1 = buffer->height;
+		}
+		*damage = (struct slurp_box){
+			.x = 0,
+			.y = y0,
+			.width = buffer->width,
+			.height = y1 - y0,
+		};
+	}
+	return pixels;
+}
+
+// Returns the number of pixels filled, text is not counted. damage is set
+// to the part of the buffer that differs from the last frame, in buffer
+// pixels.
+size_t render(struct slurp_output *output, struct slurp_box *damage) {
 	struct slurp_state *state = output->state;
 	struct pool_buffer *buffer = output->current_buffer;
-	cairo_t *cairo = buffer->cairo;
+	int32_t scale = output->scale;
+	*damage = (struct slurp_box){0};
+
+	struct render_cache *cache = get_render_cache(output);
+	if (cache == NULL) {
+		return 0;
+	}
+	cache->ops_len = 0;
+	cache->glyphs_len = 0;
+	cache->ops_failed = false;
 
 	// Clear
-	cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
-	set_source_u32(cairo, state->colors.background);
-	cairo_paint(cairo);
+	record_fill(cache, RENDER_OP_RECT, 0, 0, buffer->width, buffer->height,
+		0, state->colors.background);
 
-	// Draw option boxes from input
-	struct slurp_box *choice_box;
-	wl_list_for_each(choice_box, &state->boxes, link) {
-		if (slurp_box_intersect(&output->logical_geometry,
-					choice_box)) {
-			struct slurp_box b = *choice_box;
-			box_layout_to_output(&b, output);
-			draw_rect(cairo, &b, state->colors.choice);
-			cairo_fill(cairo);
+	// Draw option boxes from input, only the ones matching the typed hint
+	// keys in hint mode
+	struct slurp_hints *hints = state->hints;
+	if (hints != NULL && !hints_update(state)) {
+		hints = NULL;
+	}
+	if (hints != NULL) {
+		for (size_t i = hints->lo; i < hints->hi; i++) {
+			if (slurp_box_intersect(&output->logical_geometry,
+					&hints->boxes[i])) {
+				struct slurp_box b = hints->boxes[i];
+				box_layout_to_output(&b, output);
+				draw_rect(cache, &b, scale, state->colors.choice);
+			}
 		}
+	} else {
+		struct slurp_box *choice_box;
+		wl_list_for_each(choice_box, &state->boxes, link) {
+			if (slurp_box_intersect(&output->logical_geometry,
+						choice_box)) {
+				struct slurp_box b = *choice_box;
+				box_layout_to_output(&b, output);
+				draw_rect(cache, &b, scale, state->colors.choice);
+			}
+		}
+	}
+
+	if (state->display_labels || state->display_dimensions || hints != NULL) {
+		load_fonts(output, cache);
+	}
+
+	if (state->display_labels) {
+		draw_labels(output, cache);
+	}
+	if (hints != NULL) {
+		draw_hints(output, cache);
 	}
 
 	struct slurp_seat *seat;
@@ -62,27 +880,17 @@ void render(struct slurp_output *output) {
 		struct slurp_box b = current_selection->selection;
 		box_layout_to_output(&b, output);
 
-		draw_rect(cairo, &b, state->colors.selection);
-		cairo_fill(cairo);
-
-		// Draw border
-		cairo_set_line_width(cairo, state->border_weight);
-		draw_rect(cairo, &b, state->colors.border);
-		cairo_stroke(cairo);
+		draw_rect(cache, &b, scale, state->colors.selection);
+		draw_border(cache, &b, scale, state->border_weight,
+			state->colors.border);
 
 		if (state->display_dimensions) {
-			cairo_select_font_face(cairo, state->font_family,
-					       CAIRO_FONT_SLANT_NORMAL,
-					       CAIRO_FONT_WEIGHT_NORMAL);
-			cairo_set_font_size(cairo, 14);
-			set_source_u32(cairo, state->colors.border);
-			// buffer of 12 can hold selections up to 99999x99999
-			char dimensions[12];
-			snprintf(dimensions, sizeof(dimensions), "%ix%i",
-				 b.width, b.height);
-			cairo_move_to(cairo, b.x + b.width + 10,
-				      b.y + b.height + 20);
-			cairo_show_text(cairo, dimensions);
+			draw_dimensions(cache, scale, &b);
 		}
 	}
+
+	if (cache->ops_failed) {
+		fprintf(stderr, "allocation failed\n");
+	}
+	return draw_tiles(output, cache, damage);
 }
@@ -0,0 +1,558 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "hint.h"
+#include "selection.h"
+#include "slurp.h"
+
+// Feeds a session recorded with slurp -R to the selection engine, without
+// a compositor, and prints the result. With -n, the session is replayed
+// several times and the event rate is printed to stderr.
+
+static const char usage[] =
+	"Usage: slurp-replay [options...] file\n"
+	"\n"
+	"  -h           Show help message and quit.\n"
+	"  -n count     Replay the session count times.\n";
+
+// the boxes and snap edges at one point of the session
+struct replay_boxes {
+	struct slurp_box *boxes;
+	size_t len;
+	struct slurp_edges edges;
+};
+
+enum replay_op_type {
+	REPLAY_OP_EVENT,
+	REPLAY_OP_LEAVE,
+	REPLAY_OP_BOXES, // replaces all of the boxes
+	REPLAY_OP_ADD,
+	REPLAY_OP_MOVE,
+	REPLAY_OP_REMOVE,
+};
+
+struct replay_op {
+	enum replay_op_type type;
+	int seat;
+	struct selection_event event;
+	struct replay_boxes *boxes;
+	// the added box or the new geometry, and the index of the moved or
+	// removed box
+	struct slurp_box box;
+	size_t index;
+};
+
+struct replay {
+	struct replay_op *ops;
+	size_t len, cap;
+	struct replay_boxes **snapshots;
+	size_t snapshots_len;
+	int seats;
+
+	bool single_point, restrict_selection, fixed_aspect_ratio, hints;
+	double aspect_ratio;
+	int32_t snap_threshold;
+};
+
+static struct replay_op *add_op(struct replay *replay) {
+	if (replay->len == replay->cap) {
+		size_t cap = replay->cap ? replay->cap * 2 : 256;
+		struct replay_op *ops = realloc(replay->ops, cap * sizeof(*ops));
+		if (ops == NULL) {
+			fprintf(stderr, "allocation failed\n");
+			return NULL;
+		}
+		replay->ops = ops;
+		replay->cap = cap;
+	}
+	struct replay_op *op = &replay->ops[replay->len++];
+	memset(op, 0, sizeof(*op));
+	return op;
+}
+
+static struct replay_boxes *add_snapshot(struct replay *replay) {
+	struct replay_boxes **snapshots = realloc(replay->snapshots,
+		(replay->snapshots_len + 1) * sizeof(*snapshots));
+	if (snapshots == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return NULL;
+	}
+	replay->snapshots = snapshots;
+	struct replay_boxes *boxes = calloc(1, sizeof(*boxes));
+	if (boxes == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return NULL;
+	}
+	snapshots[replay->snapshots_len++] = boxes;
+
+	struct replay_op *op = add_op(replay);
+	if (op == NULL) {
+		return NULL;
+	}
+	op->type = REPLAY_OP_BOXES;
+	op->boxes = boxes;
+	return boxes;
+}
+
+static bool parse_geometry(struct slurp_box *box, const char *args,
+		bool label) {
+	*box = (struct slurp_box){0};
+	if (label) {
+		return sscanf(args, "%d %d %d %d %m[^\n]", &box->x, &box->y,
+			&box->width, &box->height, &box->label) >= 4;
+	}
+	return sscanf(args, "%d %d %d %d", &box->x, &box->y,
+		&box->width, &box->height) == 4;
+}
+
+static bool parse_box(struct replay_boxes *boxes, const char *args) {
+	struct slurp_box box;
+	if (!parse_geometry(&box, args, true)) {
+		return false;
+	}
+	struct slurp_box *list = realloc(boxes->boxes,
+		(boxes->len + 1) * sizeof(*list));
+	if (list == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		free(box.label);
+		return false;
+	}
+	boxes->boxes = list;
+	list[boxes->len++] = box;
+	return true;
+}
+
+static bool parse_edges(struct replay_boxes *boxes, const char *args) {
+	char axis;
+	size_t len;
+	int n;
+	if (sscanf(args, "%c %zu%n", &axis, &len, &n) != 2 ||
+			(axis != 'x' && axis != 'y')) {
+		return false;
+	}
+	struct slurp_edge_list *list =
+		axis == 'x' ? &boxes->edges.x : &boxes->edges.y;
+	free(list->data);
+	free(list->counts);
+	list->data = calloc(len ? len : 1, sizeof(*list->data));
+	list->counts = calloc(len ? len : 1, sizeof(*list->counts));
+	if (list->data == NULL || list->counts == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return false;
+	}
+	list->len = list->cap = len;
+	args += n;
+	for (size_t i = 0; i < len; i++) {
+		if (sscanf(args, "%d%n", &list->data[i], &n) != 1) {
+			return false;
+		}
+		args += n;
+		list->counts[i] = 1;
+		if (args[0] == ':') {
+			if (sscanf(args, ":%" SCNu32 "%n", &list->counts[i], &n) != 1) {
+				return false;
+			}
+			args += n;
+		}
+	}
+	boxes->edges.built = true;
+	return true;
+}
+
+static bool parse_event(struct replay *replay, const char *line) {
+	int seat, n;
+	char type[16];
+	if (sscanf(line, "%d %15s%n", &seat, type, &n) != 2 || seat < 0) {
+		return false;
+	}
+	const char *args = line + n;
+
+	if (strcmp(type, "leave") == 0) {
+		struct replay_op *op = add_op(replay);
+		if (op == NULL) {
+			return false;
+		}
+		op->type = REPLAY_OP_LEAVE;
+		op->seat = seat;
+		if (seat >= replay->seats) {
+			replay->seats = seat + 1;
+		}
+		return true;
+	}
+
+	struct selection_event event = {0};
+	int pressed = 0;
+	bool ok;
+	if (strcmp(type, "enter") == 0 || strcmp(type, "motion") == 0) {
+		event.type = strcmp(type, "enter") == 0 ?
+			SELECTION_EVENT_POINTER_ENTER : SELECTION_EVENT_POINTER_MOTION;
+		ok = sscanf(args, "%d %d", &event.x, &event.y) == 2;
+	} else if (strcmp(type, "button") == 0) {
+		event.type = SELECTION_EVENT_POINTER_BUTTON;
+		ok = sscanf(args, "%d", &pressed) == 1;
+	} else if (strcmp(type, "axis") == 0) {
+		event.type = SELECTION_EVENT_POINTER_AXIS;
+		ok = sscanf(args, "%d", &event.y) == 1;
+	} else if (strcmp(type, "key") == 0) {
+		event.type = SELECTION_EVENT_KEY;
+		ok = sscanf(args, "%u %d", &event.keysym, &pressed) == 2;
+	} else if (strcmp(type, "touch-down") == 0 ||
+			strcmp(type, "touch-motion") == 0) {
+		event.type = strcmp(type, "touch-down") == 0 ?
+			SELECTION_EVENT_TOUCH_DOWN : SELECTION_EVENT_TOUCH_MOTION;
+		ok = sscanf(args, "%d %d %d", &event.touch_id,
+			&event.x, &event.y) == 3;
+	} else if (strcmp(type, "touch-up") == 0 ||
+			strcmp(type, "touch-cancel") == 0) {
+		event.type = strcmp(type, "touch-up") == 0 ?
+			SELECTION_EVENT_TOUCH_UP : SELECTION_EVENT_TOUCH_CANCEL;
+		ok = sscanf(args, "%d", &event.touch_id) == 1;
+	} else {
+		ok = false;
+	}
+	if (!ok) {
+		return false;
+	}
+	event.pressed = pressed;
+
+	struct replay_op *op = add_op(replay);
+	if (op == NULL) {
+		return false;
+	}
+	op->type = REPLAY_OP_EVENT;
+	op->seat = seat;
+	op->event = event;
+	if (seat >= replay->seats) {
+		replay->seats = seat + 1;
+	}
+	return true;
+}
+
+static bool parse_line(struct replay *replay, const char *line) {
+	struct replay_boxes *boxes = replay->snapshots_len ?
+		replay->snapshots[replay->snapshots_len - 1] : NULL;
+	if (strncmp(line, "config ", 7) == 0) {
+		int single_point, restrict_selection, fixed_aspect_ratio, hints = 0;
+		if (sscanf(line + 7, "%d %d %d %lf %d %d", &single_point,
+				&restrict_selection, &fixed_aspect_ratio,
+				&replay->aspect_ratio, &replay->snap_threshold, &hints) < 5) {
+			return false;
+		}
+		replay->hints = hints;
+		replay->single_point = single_point;
+		replay->restrict_selection = restrict_selection;
+		replay->fixed_aspect_ratio = fixed_aspect_ratio;
+		return true;
+	} else if (strcmp(line, "boxes") == 0) {
+		return add_snapshot(replay) != NULL;
+	} else if (strncmp(line, "box ", 4) == 0) {
+		return boxes != NULL && parse_box(boxes, line + 4);
+	} else if (strncmp(line, "edges ", 6) == 0) {
+		return boxes != NULL && parse_edges(boxes, line + 6);
+	} else if (strncmp(line, "add ", 4) == 0) {
+		struct replay_op *op = add_op(replay);
+		if (op == NULL) {
+			return false;
+		}
+		op->type = REPLAY_OP_ADD;
+		return parse_geometry(&op->box, line + 4, true);
+	} else if (strncmp(line, "move ", 5) == 0) {
+		int n;
+		struct replay_op *op = add_op(replay);
+		if (op == NULL) {
+			return false;
+		}
+		op->type = REPLAY_OP_MOVE;
+		return sscanf(line + 5, "%zu%n", &op->index, &n) == 1 &&
+			parse_geometry(&op->box, line + 5 + n, false);
+	} else if (strncmp(line, "remove ", 7) == 0) {
+		struct replay_op *op = add_op(replay);
+		if (op == NULL) {
+			return false;
+		}
+		op->type = REPLAY_OP_REMOVE;
+		return sscanf(line + 7, "%zu", &op->index) == 1;
+	}
+	return parse_event(replay, line);
+}
+
+static bool replay_load(struct replay *replay, FILE *f) {
+	char *line = NULL;
+	size_t line_size = 0;
+	ssize_t len;
+	int lineno = 0;
+	bool ok = true;
+	while (ok && (len = getline(&line, &line_size, f)) >= 0) {
+		lineno++;
+		if (len > 0 && line[len - 1] == '\n') {
+			line[len - 1] = '\0';
+		}
+		if (line[0] == '\0') {
+			continue;
+		}
+		if (!parse_line(replay, line)) {
+			fprintf(stderr, "invalid record at line %d: %s\n", lineno, line);
+			ok = false;
+		}
+	}
+	free(line);
+	return ok;
+}
+
+static void replay_finish(struct replay *replay) {
+	for (size_t i = 0; i < replay->snapshots_len; i++) {
+		struct replay_boxes *boxes = replay->snapshots[i];
+		for (size_t j = 0; j < boxes->len; j++) {
+			free(boxes->boxes[j].label);
+		}
+		free(boxes->boxes);
+		free(boxes->edges.x.data);
+		free(boxes->edges.x.counts);
+		free(boxes->edges.y.data);
+		free(boxes->edges.y.counts);
+		free(boxes);
+	}
+	for (size_t i = 0; i < replay->len; i++) {
+		free(replay->ops[i].box.label);
+	}
+	free(replay->snapshots);
+	free(replay->ops);
+}
+
+static void clear_boxes(struct slurp_state *state) {
+	struct slurp_box *box, *box_tmp;
+	wl_list_for_each_safe(box, box_tmp, &state->boxes, link) {
+		wl_list_remove(&box->link);
+		free(box->label);
+		free(box);
+	}
+	free(state->snap_edges.x.data);
+	free(state->snap_edges.x.counts);
+	free(state->snap_edges.y.data);
+	free(state->snap_edges.y.counts);
+	state->snap_edges = (struct slurp_edges){0};
+}
+
+static bool copy_edges(struct slurp_edge_list *dst,
+		const struct slurp_edge_list *src) {
+	size_t cap = src->len ? src->len : 1;
+	dst->data = malloc(cap * sizeof(*dst->data));
+	dst->counts = malloc(cap * sizeof(*dst->counts));
+	if (dst->data == NULL || dst->counts == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return false;
+	}
+	memcpy(dst->data, src->data, src->len * sizeof(*dst->data));
+	memcpy(dst->counts, src->counts, src->len * sizeof(*dst->counts));
+	dst->len = src->len;
+	dst->cap = cap;
+	return true;
+}
+
+// The boxes are copied, later add, move and remove ops change them like in
+// the session.
+static bool use_boxes(struct slurp_state *state, struct replay_boxes *boxes) {
+	clear_boxes(state);
+	for (size_t i = 0; i < boxes->len; i++) {
+		struct slurp_box *box = calloc(1, sizeof(*box));
+		if (box == NULL) {
+			fprintf(stderr, "allocation failed\n");
+			return false;
+		}
+		*box = boxes->boxes[i];
+		box->label = NULL;
+		if (boxes->boxes[i].label != NULL) {
+			box->label = strdup(boxes->boxes[i].label);
+		}
+		wl_list_insert(state->boxes.prev, &box->link);
+	}
+	if (boxes->edges.built) {
+		if (!copy_edges(&state->snap_edges.x, &boxes->edges.x) ||
+				!copy_edges(&state->snap_edges.y, &boxes->edges.y)) {
+			return false;
+		}
+		state->snap_edges.built = true;
+	}
+	selection_invalidate_hover(state);
+	return true;
+}
+
+static struct slurp_box *box_at(struct slurp_state *state, size_t index) {
+	struct slurp_box *box;
+	wl_list_for_each(box, &state->boxes, link) {
+		if (index-- == 0) {
+			return box;
+		}
+	}
+	return NULL;
+}
+
+static struct slurp_output replay_output;
+
+// Runs the session once, returns the number of events handled
+static size_t replay_run(struct replay *replay, struct slurp_state *state,
+		struct slurp_seat *seats) {
+	state->running = true;
+	state->edit_anchor = false;
+	state->aspect_ratio = replay->aspect_ratio;
+	state->result = (struct slurp_box){0};
+	if (state->hints != NULL) {
+		hints_invalidate(state->hints);
+	}
+	clear_boxes(state);
+
+	wl_list_init(&state->seats);
+	for (int i = 0; i < replay->seats; i++) {
+		struct slurp_seat *seat = &seats[i];
+		memset(seat, 0, sizeof(*seat));
+		seat->state = state;
+		seat->id = i;
+		seat->touch_id = TOUCH_ID_EMPTY;
+		wl_list_insert(&state->seats, &seat->link);
+	}
+
+	size_t events = 0;
+	for (size_t i = 0; i < replay->len && state->running; i++) {
+		struct replay_op *op = &replay->ops[i];
+		struct slurp_seat *seat = &seats[op->seat];
+		struct slurp_box *box;
+		switch (op->type) {
+		case REPLAY_OP_EVENT:
+			// only compared with NULL, box changes pick the hovered box
+			// again right away while the pointer is on an output
+			if (op->event.type == SELECTION_EVENT_POINTER_ENTER) {
+				seat->pointer_selection.current_output = &replay_output;
+			}
+			selection_handle_event(seat, &op->event);
+			events++;
+			break;
+		case REPLAY_OP_LEAVE:
+			seat->pointer_selection.current_output = NULL;
+			break;
+		case REPLAY_OP_BOXES:
+			if (!use_boxes(state, op->boxes)) {
+				state->running = false;
+			}
+			break;
+		case REPLAY_OP_ADD:
+			if (slurp_add_choice_box(state, &op->box) == NULL) {
+				state->running = false;
+			}
+			break;
+		case REPLAY_OP_MOVE:
+			box = box_at(state, op->index);
+			if (box != NULL) {
+				slurp_move_choice_box(state, box, &op->box);
+			}
+			break;
+		case REPLAY_OP_REMOVE:
+			box = box_at(state, op->index);
+			if (box != NULL) {
+				slurp_remove_choice_box(state, box);
+			}
+			break;
+		}
+	}
+	return events;
+}
+
+static double timespec_diff(const struct timespec *a,
+		const struct timespec *b) {
+	return (double)(b->tv_sec - a->tv_sec) +
+		(double)(b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+	long count = 1;
+	int opt;
+	while ((opt = getopt(argc, argv, "hn:")) != -1) {
+		switch (opt) {
+		case 'h':
+			printf("%s", usage);
+			return EXIT_SUCCESS;
+		case 'n': {
+			errno = 0;
+			char *endptr;
+			count = strtol(optarg, &endptr, 10);
+			if (*endptr || errno || count <= 0) {
+				fprintf(stderr, "Error: expected positive numeric argument for -n\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		}
+		default:
+			printf("%s", usage);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind + 1 != argc) {
+		printf("%s", usage);
+		return EXIT_FAILURE;
+	}
+
+	FILE *f = fopen(argv[optind], "r");
+	if (f == NULL) {
+		fprintf(stderr, "failed to open %s: %s\n", argv[optind], strerror(errno));
+		return EXIT_FAILURE;
+	}
+	struct replay replay = {0};
+	bool ok = replay_load(&replay, f);
+	fclose(f);
+	if (!ok) {
+		replay_finish(&replay);
+		return EXIT_FAILURE;
+	}
+
+	struct slurp_state state = {0};
+	slurp_state_init(&state);
+	state.single_point = replay.single_point;
+	state.restrict_selection = replay.restrict_selection;
+	state.fixed_aspect_ratio = replay.fixed_aspect_ratio;
+	state.snap_threshold = replay.snap_threshold;
+	struct slurp_hints hints = {0};
+	if (replay.hints) {
+		state.hints = &hints;
+	}
+
+	struct slurp_seat *seats = calloc(replay.seats ? replay.seats : 1,
+		sizeof(*seats));
+	if (seats == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		replay_finish(&replay);
+		return EXIT_FAILURE;
+	}
+
+	struct timespec start, end;
+	size_t events = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long i = 0; i < count; i++) {
+		events += replay_run(&replay, &state, seats);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	int status = EXIT_SUCCESS;
+	if (state.result.width == 0 && state.result.height == 0) {
+		fprintf(stderr, "selection cancelled\n");
+		status = EXIT_FAILURE;
+	} else {
+		printf("%d,%d %dx%d\n", state.result.x, state.result.y,
+			state.result.width, state.result.height);
+	}
+	if (count > 1) {
+		double elapsed = timespec_diff(&start, &end);
+		fprintf(stderr, "%zu events in %.3f s, %.0f events/s\n", events,
+			elapsed, elapsed > 0 ? events / elapsed : 0);
+	}
+
+	clear_boxes(&state);
+	free(seats);
+	hints_finish(&hints);
+	replay_finish(&replay);
+	return status;
+}
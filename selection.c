@@ -0,0 +1,972 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include "hint.h"
+#include "selection.h"
+#include "slurp.h"
+#include "stream.h"
+
+static int32_t box_size(const struct slurp_box *box) {
+	return box->width * box->height;
+}
+
+static int max(int a, int b) {
+	return (a > b) ? a : b;
+}
+
+static void record_event(struct slurp_seat *seat,
+	const struct selection_event *event);
+
+static void damage_seat(struct slurp_seat *seat) {
+	struct slurp_state *state = seat->state;
+	if (state->selection_damage != NULL) {
+		state->selection_damage(seat);
+	}
+}
+
+static void move_seat(struct slurp_seat *seat, int32_t x, int32_t y,
+		struct slurp_selection *current_selection) {
+	if (seat->state->edit_anchor) {
+		current_selection->anchor_x += x - current_selection->x;
+		current_selection->anchor_y += y - current_selection->y;
+	}
+
+	current_selection->x = x;
+	current_selection->y = y;
+}
+
+// Shrink the hover region so that it no longer overlaps the box, keeping
+// the side which leaves the largest area around the cursor.
+static void hover_region_exclude(struct slurp_box *region, int32_t x, int32_t y,
+		const struct slurp_box *box) {
+	int32_t x0 = region->x, y0 = region->y;
+	int32_t x1 = region->x + region->width, y1 = region->y + region->height;
+	int64_t best_area = -1;
+	struct slurp_box best = *region;
+
+	struct slurp_box candidates[4] = {
+		{ .x = box->x + box->width, .y = y0,
+			.width = x1 - (box->x + box->width), .height = y1 - y0 },
+		{ .x = x0, .y = y0, .width = box->x - x0, .height = y1 - y0 },
+		{ .x = x0, .y = box->y + box->height,
+			.width = x1 - x0, .height = y1 - (box->y + box->height) },
+		{ .x = x0, .y = y0, .width = x1 - x0, .height = box->y - y0 },
+	};
+	for (size_t i = 0; i < 4; i++) {
+		struct slurp_box *c = &candidates[i];
+		if (!slurp_box_contains(c, x, y)) {
+			continue;
+		}
+		int64_t area = (int64_t)c->width * c->height;
+		if (area > best_area) {
+			best_area = area;
+			best = *c;
+		}
+	}
+	*region = best;
+}
+
+static void seat_update_selection(struct slurp_seat *seat) {
+	struct slurp_selection *selection = &seat->pointer_selection;
+	selection->has_selection = false;
+
+	// find smallest box intersecting the cursor
+	struct slurp_box *box, *hovered = NULL;
+	wl_list_for_each(box, &seat->state->boxes, link) {
+		if (slurp_box_contains(box, selection->x, selection->y)) {
+			if (selection->has_selection &&
+				box_size(&selection->selection) < box_size(box)) {
+				continue;
+			}
+			selection->selection = *box;
+			selection->has_selection = true;
+			hovered = box;
+		}
+	}
+
+	// The result stays the same as long as the cursor remains inside the
+	// hovered box and doesn't enter any box that is at most as large.
+	struct slurp_box *region = &seat->hover_region;
+	if (hovered != NULL) {
+		*region = *hovered;
+	} else {
+		region->x = region->y = INT32_MIN / 2;
+		region->width = region->height = INT32_MAX;
+	}
+	wl_list_for_each(box, &seat->state->boxes, link) {
+		if (box == hovered || slurp_box_contains(box, selection->x, selection->y) ||
+				(hovered != NULL && box_size(box) > box_size(hovered)) ||
+				!slurp_box_intersect(region, box)) {
+			continue;
+		}
+		hover_region_exclude(region, selection->x, selection->y, box);
+	}
+	seat->hover_valid = true;
+	seat->nav_box = hovered;
+	seat->nav_depth = 0;
+
+	if (seat->state->stream != NULL) {
+		if (selection->has_selection) {
+			stream_set_box(seat->state->stream, &selection->selection);
+		} else {
+			stream_clear(seat->state->stream);
+		}
+	}
+}
+
+static int compare_int32(const void *a, const void *b) {
+	int32_t x = *(const int32_t *)a, y = *(const int32_t *)b;
+	return (x > y) - (x < y);
+}
+
+// index of the first edge >= v
+static size_t edge_lower_bound(const struct slurp_edge_list *edges, int32_t v) {
+	size_t lo = 0, hi = edges->len;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (edges->data[mid] < v) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static bool edge_list_reserve(struct slurp_edge_list *edges, size_t len) {
+	if (len <= edges->cap) {
+		return true;
+	}
+	size_t cap = edges->cap ? edges->cap : 16;
+	while (cap < len) {
+		cap *= 2;
+	}
+	int32_t *data = realloc(edges->data, cap * sizeof(*data));
+	if (data == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return false;
+	}
+	edges->data = data;
+	uint32_t *counts = realloc(edges->counts, cap * sizeof(*counts));
+	if (counts == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return false;
+	}
+	edges->counts = counts;
+	edges->cap = cap;
+	return true;
+}
+
+static void edge_list_sort(struct slurp_edge_list *edges) {
+	if (edges->len == 0) {
+		return;
+	}
+	qsort(edges->data, edges->len, sizeof(*edges->data), compare_int32);
+	size_t n = 1;
+	edges->counts[0] = 1;
+	for (size_t i = 1; i < edges->len; i++) {
+		if (edges->data[i] != edges->data[n - 1]) {
+			edges->data[n] = edges->data[i];
+			edges->counts[n++] = 1;
+		} else {
+			edges->counts[n - 1]++;
+		}
+	}
+	edges->len = n;
+}
+
+static void edge_list_insert(struct slurp_edge_list *edges, int32_t v) {
+	size_t i = edge_lower_bound(edges, v);
+	if (i < edges->len && edges->data[i] == v) {
+		edges->counts[i]++;
+		return;
+	}
+	if (!edge_list_reserve(edges, edges->len + 1)) {
+		return;
+	}
+	memmove(&edges->data[i + 1], &edges->data[i],
+		(edges->len - i) * sizeof(*edges->data));
+	memmove(&edges->counts[i + 1], &edges->counts[i],
+		(edges->len - i) * sizeof(*edges->counts));
+	edges->data[i] = v;
+	edges->counts[i] = 1;
+	edges->len++;
+}
+
+static void edge_list_remove(struct slurp_edge_list *edges, int32_t v) {
+	size_t i = edge_lower_bound(edges, v);
+	if (i == edges->len || edges->data[i] != v) {
+		return;
+	}
+	if (--edges->counts[i] > 0) {
+		return;
+	}
+	memmove(&edges->data[i], &edges->data[i + 1],
+		(edges->len - i - 1) * sizeof(*edges->data));
+	memmove(&edges->counts[i], &edges->counts[i + 1],
+		(edges->len - i - 1) * sizeof(*edges->counts));
+	edges->len--;
+}
+
+static void add_box_edges(struct slurp_edges *edges, const struct slurp_box *box) {
+	// snap to the first and last pixel covered by the box
+	if (!edge_list_reserve(&edges->x, edges->x.len + 2) ||
+			!edge_list_reserve(&edges->y, edges->y.len + 2)) {
+		return;
+	}
+	edges->x.data[edges->x.len++] = box->x;
+	edges->x.data[edges->x.len++] = box->x + box->width - 1;
+	edges->y.data[edges->y.len++] = box->y;
+	edges->y.data[edges->y.len++] = box->y + box->height - 1;
+}
+
+void selection_build_snap_edges(struct slurp_state *state) {
+	struct slurp_edges *edges = &state->snap_edges;
+	struct slurp_box *box;
+	wl_list_for_each(box, &state->boxes, link) {
+		add_box_edges(edges, box);
+	}
+	edge_list_sort(&edges->x);
+	edge_list_sort(&edges->y);
+	edges->built = true;
+}
+
+// Keeps the index sorted when boxes or outputs show up after startup
+void selection_insert_snap_edges(struct slurp_state *state,
+		const struct slurp_box *box) {
+	struct slurp_edges *edges = &state->snap_edges;
+	if (!edges->built) {
+		return;
+	}
+	edge_list_insert(&edges->x, box->x);
+	edge_list_insert(&edges->x, box->x + box->width - 1);
+	edge_list_insert(&edges->y, box->y);
+	edge_list_insert(&edges->y, box->y + box->height - 1);
+}
+
+void selection_remove_snap_edges(struct slurp_state *state,
+		const struct slurp_box *box) {
+	struct slurp_edges *edges = &state->snap_edges;
+	if (!edges->built) {
+		return;
+	}
+	edge_list_remove(&edges->x, box->x);
+	edge_list_remove(&edges->x, box->x + box->width - 1);
+	edge_list_remove(&edges->y, box->y);
+	edge_list_remove(&edges->y, box->y + box->height - 1);
+}
+
+static bool box_contains_box(const struct slurp_box *a,
+		const struct slurp_box *b) {
+	return a->x <= b->x && a->y <= b->y &&
+		a->x + a->width >= b->x + b->width &&
+		a->y + a->height >= b->y + b->height;
+}
+
+struct forest_entry {
+	struct slurp_box *box;
+	size_t order;
+};
+
+// larger boxes first, list order among equal areas
+static int compare_forest_entry(const void *a, const void *b) {
+	const struct forest_entry *x = a, *y = b;
+	int64_t area_x = (int64_t)x->box->width * x->box->height;
+	int64_t area_y = (int64_t)y->box->width * y->box->height;
+	if (area_x != area_y) {
+		return (area_x < area_y) - (area_x > area_y);
+	}
+	return (x->order > y->order) - (x->order < y->order);
+}
+
+// A box edge in the sweep, pos is the coordinate and rank the index of the
+// box in the sorted entries.
+struct forest_event {
+	int64_t pos;
+	bool end;
+	size_t rank;
+};
+
+// ends first so that touching boxes don't overlap, starts of outer boxes
+// before inner ones and ends of inner boxes before outer ones
+static int compare_forest_event(const void *a, const void *b) {
+	const struct forest_event *x = a, *y = b;
+	if (x->pos != y->pos) {
+		return (x->pos > y->pos) - (x->pos < y->pos);
+	}
+	if (x->end != y->end) {
+		return x->end ? -1 : 1;
+	}
+	if (x->end) {
+		return (x->rank < y->rank) - (x->rank > y->rank);
+	}
+	return (x->rank > y->rank) - (x->rank < y->rank);
+}
+
+// A max tree over the top and bottom edges sorted vertically, leaves start
+// at size. The leaf of a box's top edge holds the position of its bottom
+// edge plus one while the box crosses the sweep line, or 0.
+static void tree_set(size_t *tree, size_t size, size_t leaf, size_t value) {
+	size_t node = leaf + size;
+	tree[node] = value;
+	for (node /= 2; node > 0; node /= 2) {
+		size_t left = tree[2 * node], right = tree[2 * node + 1];
+		tree[node] = left > right ? left : right;
+	}
+}
+
+// the last leaf before leaf holding more than min, or SIZE_MAX
+static size_t tree_prev(const size_t *tree, size_t size, size_t leaf,
+		size_t min) {
+	for (size_t node = leaf + size; node > 1; node /= 2) {
+		if ((node & 1) && tree[node - 1] > min) {
+			node--;
+			while (node < size) {
+				node = 2 * node + (tree[2 * node + 1] > min);
+			}
+			return node - size;
+		}
+	}
+	return SIZE_MAX;
+}
+
+// Links every box to a box containing it, the smallest one unless boxes
+// partly overlap. The boxes are swept from left to right while a tree
+// keeps the boxes crossing the sweep line by their top edge. Going back
+// from the top edge of a new box, the first box also reaching past its
+// bottom edge is its parent, partly overlapping boxes may need a few more
+// steps until one that contains it horizontally too.
+static bool build_forest(struct slurp_state *state) {
+	size_t len = wl_list_length(&state->boxes);
+	size_t size = 1;
+	while (size < 2 * len) {
+		size *= 2;
+	}
+	struct forest_entry *entries = calloc(len ? len : 1, sizeof(*entries));
+	struct forest_event *edges = calloc(2 * len + 1, sizeof(*edges));
+	struct forest_event *sweep = calloc(2 * len + 1, sizeof(*sweep));
+	size_t *tokens = calloc(2 * len + 1, sizeof(*tokens));
+	size_t *tree = calloc(2 * size, sizeof(*tree));
+	if (entries == NULL || edges == NULL || sweep == NULL ||
+			tokens == NULL || tree == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		free(entries);
+		free(edges);
+		free(sweep);
+		free(tokens);
+		free(tree);
+		return false;
+	}
+	size_t i = 0;
+	struct slurp_box *box;
+	wl_list_for_each(box, &state->boxes, link) {
+		box->parent = NULL;
+		entries[i].box = box;
+		entries[i].order = i;
+		i++;
+	}
+	qsort(entries, len, sizeof(*entries), compare_forest_entry);
+
+	// empty boxes only contain empty boxes, they're linked afterwards
+	size_t edges_len = 0;
+	for (i = 0; i < len; i++) {
+		box = entries[i].box;
+		if (box->width <= 0 || box->height <= 0) {
+			continue;
+		}
+		edges[edges_len] = (struct forest_event){box->y, false, i};
+		sweep[edges_len++] = (struct forest_event){box->x, false, i};
+		edges[edges_len] = (struct forest_event){
+			(int64_t)box->y + box->height, true, i};
+		sweep[edges_len++] = (struct forest_event){
+			(int64_t)box->x + box->width, true, i};
+	}
+	qsort(edges, edges_len, sizeof(*edges), compare_forest_event);
+	qsort(sweep, edges_len, sizeof(*sweep), compare_forest_event);
+	// the top edge of each box is at tokens[2 * rank], the bottom one after
+	for (i = 0; i < edges_len; i++) {
+		tokens[2 * edges[i].rank + edges[i].end] = i;
+	}
+
+	for (i = 0; i < edges_len; i++) {
+		size_t rank = sweep[i].rank;
+		size_t top = tokens[2 * rank], bottom = tokens[2 * rank + 1];
+		if (sweep[i].end) {
+			tree_set(tree, size, top, 0);
+			continue;
+		}
+
+		box = entries[rank].box;
+		for (size_t j = tree_prev(tree, size, top, bottom + 1);
+				j != SIZE_MAX; j = tree_prev(tree, size, j, bottom + 1)) {
+			struct slurp_box *other = entries[edges[j].rank].box;
+			if (box_contains_box(other, box)) {
+				box->parent = other;
+				break;
+			}
+		}
+		tree_set(tree, size, top, bottom + 1);
+	}
+
+	for (i = 0; i < len; i++) {
+		box = entries[i].box;
+		if (box->width > 0 && box->height > 0) {
+			continue;
+		}
+		for (size_t j = i; j > 0; j--) {
+			if (box_contains_box(entries[j - 1].box, box)) {
+				box->parent = entries[j - 1].box;
+				break;
+			}
+		}
+	}
+
+	free(entries);
+	free(edges);
+	free(sweep);
+	free(tokens);
+	free(tree);
+	state->forest_valid = true;
+	return true;
+}
+
+// Moves the pointer selection one level up or down the forest, down
+// retraces the steps the seat took up from the hovered box.
+static void navigate_forest(struct slurp_seat *seat, bool up) {
+	struct slurp_state *state = seat->state;
+	struct slurp_selection *selection = &seat->pointer_selection;
+	if (seat->button_state != WL_POINTER_BUTTON_STATE_RELEASED ||
+			!seat->hover_valid || seat->nav_box == NULL) {
+		return;
+	}
+	if (!state->forest_valid && !build_forest(state)) {
+		return;
+	}
+
+	struct slurp_box *box = seat->nav_box;
+	if (up) {
+		if (box->parent == NULL || seat->nav_depth == SLURP_NAV_DEPTH) {
+			return;
+		}
+		seat->nav_path[seat->nav_depth++] = box;
+		box = box->parent;
+	} else {
+		if (seat->nav_depth == 0) {
+			return;
+		}
+		box = seat->nav_path[--seat->nav_depth];
+	}
+
+	damage_seat(seat);
+	seat->nav_box = box;
+	selection->selection = *box;
+	selection->has_selection = true;
+	damage_seat(seat);
+
+	if (state->stream != NULL) {
+		stream_set_box(state->stream, &selection->selection);
+	}
+}
+
+static int32_t snap_to_edge(const struct slurp_edge_list *edges, int32_t v,
+		int32_t threshold) {
+	size_t i = edge_lower_bound(edges, v);
+	int32_t best = v;
+	int32_t best_dist = threshold + 1;
+	if (i < edges->len && edges->data[i] - v < best_dist) {
+		best = edges->data[i];
+		best_dist = edges->data[i] - v;
+	}
+	if (i > 0 && v - edges->data[i - 1] < best_dist) {
+		best = edges->data[i - 1];
+	}
+	return best;
+}
+
+static void handle_active_selection_motion(struct slurp_seat *seat, struct slurp_selection *current_selection) {
+	if(seat->state->restrict_selection){
+		return;
+	}
+
+	int32_t x = current_selection->x;
+	int32_t y = current_selection->y;
+	struct slurp_edges *edges = &seat->state->snap_edges;
+	if (seat->state->snap_threshold > 0) {
+		x = snap_to_edge(&edges->x, x, seat->state->snap_threshold);
+		y = snap_to_edge(&edges->y, y, seat->state->snap_threshold);
+	}
+
+	int32_t anchor_x = current_selection->anchor_x;
+	int32_t anchor_y = current_selection->anchor_y;
+	int32_t dist_x = x - anchor_x;
+	int32_t dist_y = y - anchor_y;
+
+	current_selection->has_selection = true;
+	// selection includes the seat and anchor positions
+	int32_t width = abs(dist_x) + 1;
+	int32_t height = abs(dist_y) + 1;
+	if (seat->state->aspect_ratio) {
+		width = max(width, height / seat->state->aspect_ratio);
+		height = max(height, width * seat->state->aspect_ratio);
+	}
+	current_selection->selection.x = dist_x > 0 ? anchor_x : anchor_x - (width - 1);
+	current_selection->selection.y = dist_y > 0 ? anchor_y : anchor_y - (height - 1);
+	current_selection->selection.width = width;
+	current_selection->selection.height = height;
+
+	if (seat->state->stream != NULL) {
+		stream_set_box(seat->state->stream, &current_selection->selection);
+	}
+}
+
+static void handle_selection_start(struct slurp_seat *seat,
+				   struct slurp_selection *current_selection) {
+	struct slurp_state *state = seat->state;
+
+	if (state->single_point) {
+		state->result.x = current_selection->x;
+		state->result.y = current_selection->y;
+		state->result.width = state->result.height = 1;
+		state->running = false;
+	} else if (state->restrict_selection) {
+		if (current_selection->has_selection) {
+			state->result = current_selection->selection;
+			state->running = false;
+		}
+	} else {
+		current_selection->anchor_x = current_selection->x;
+		current_selection->anchor_y = current_selection->y;
+	}
+}
+
+static void handle_selection_end(struct slurp_seat *seat,
+				 struct slurp_selection *current_selection) {
+	struct slurp_state *state = seat->state;
+	if (state->single_point || state->restrict_selection) {
+		return;
+	}
+	if (current_selection->has_selection) {
+		state->result = current_selection->selection;
+	}
+	state->running = false;
+}
+
+static void pointer_move(struct slurp_seat *seat,
+		const struct selection_event *event) {
+	move_seat(seat, event->x, event->y, &seat->pointer_selection);
+
+	// nothing to do while the hovered box stays the same
+	if (event->type == SELECTION_EVENT_POINTER_MOTION &&
+			seat->button_state == WL_POINTER_BUTTON_STATE_RELEASED &&
+			seat->hover_valid && slurp_box_contains(&seat->hover_region,
+				seat->pointer_selection.x, seat->pointer_selection.y)) {
+		return;
+	}
+
+	// the places the cursor moved away from are also dirty
+	if (seat->pointer_selection.has_selection) {
+		damage_seat(seat);
+	}
+
+	switch (seat->button_state) {
+	case WL_POINTER_BUTTON_STATE_RELEASED:
+		seat_update_selection(seat);
+		break;
+	case WL_POINTER_BUTTON_STATE_PRESSED:;
+		handle_active_selection_motion(seat, &seat->pointer_selection);
+		break;
+	}
+
+	if (event->type == SELECTION_EVENT_POINTER_ENTER ||
+			seat->pointer_selection.has_selection) {
+		damage_seat(seat);
+	}
+}
+
+static void pointer_button(struct slurp_seat *seat, bool pressed) {
+	if (seat->touch_selection.has_selection) {
+		return;
+	}
+
+	seat->button_state = pressed ? WL_POINTER_BUTTON_STATE_PRESSED :
+		WL_POINTER_BUTTON_STATE_RELEASED;
+	seat->hover_valid = false;
+
+	if (pressed) {
+		handle_selection_start(seat, &seat->pointer_selection);
+	} else {
+		handle_selection_end(seat, &seat->pointer_selection);
+	}
+}
+
+// Recompute the selection if the aspect ratio changed.
+static void recompute_selection(struct slurp_seat *seat) {
+	struct slurp_selection *current = slurp_seat_current_selection(seat);
+	if (current->has_selection) {
+		handle_active_selection_motion(seat, slurp_seat_current_selection(seat));
+		damage_seat(seat);
+	}
+}
+
+static void key(struct slurp_seat *seat, uint32_t keysym, bool pressed) {
+	struct slurp_state *state = seat->state;
+	if (pressed && state->hints != NULL && hints_handle_key(state, keysym)) {
+		return;
+	}
+
+	if (pressed) {
+		switch (keysym) {
+		case XKB_KEY_Escape:
+			seat->hover_valid = false;
+			seat->pointer_selection.has_selection = false;
+			seat->touch_selection.has_selection = false;
+			state->edit_anchor = false;
+			state->running = false;
+			break;
+
+		case XKB_KEY_space:
+			if (!seat->pointer_selection.has_selection &&
+					!seat->touch_selection.has_selection) {
+				break;
+			}
+			state->edit_anchor = true;
+			break;
+		case XKB_KEY_Shift_L:
+		case XKB_KEY_Shift_R:
+			if (!state->fixed_aspect_ratio) {
+				state->aspect_ratio = 1;
+				recompute_selection(seat);
+			}
+			break;
+		case XKB_KEY_Up:
+			navigate_forest(seat, true);
+			break;
+		case XKB_KEY_Down:
+			navigate_forest(seat, false);
+			break;
+		}
+	} else {
+		if (keysym == XKB_KEY_space) {
+			state->edit_anchor = false;
+		} else if (!state->fixed_aspect_ratio && (keysym == XKB_KEY_Shift_L || keysym == XKB_KEY_Shift_R)) {
+			state->aspect_ratio = 0;
+			recompute_selection(seat);
+		}
+	}
+}
+
+static void touch_clear_state(struct slurp_seat *seat) {
+	seat->touch_id = TOUCH_ID_EMPTY;
+	seat->touch_selection.current_output = NULL;
+}
+
+void selection_handle_event(struct slurp_seat *seat,
+		const struct selection_event *event) {
+	if (seat->state->recorder != NULL) {
+		record_event(seat, event);
+	}
+
+	switch (event->type) {
+	case SELECTION_EVENT_POINTER_ENTER:
+	case SELECTION_EVENT_POINTER_MOTION:
+		pointer_move(seat, event);
+		break;
+	case SELECTION_EVENT_POINTER_BUTTON:
+		pointer_button(seat, event->pressed);
+		break;
+	case SELECTION_EVENT_POINTER_AXIS:
+		navigate_forest(seat, event->y < 0);
+		break;
+	case SELECTION_EVENT_KEY:
+		key(seat, event->keysym, event->pressed);
+		break;
+	case SELECTION_EVENT_TOUCH_DOWN:
+		if (seat->pointer_selection.has_selection) {
+			break;
+		}
+		if (seat->touch_id == TOUCH_ID_EMPTY) {
+			seat->touch_id = event->touch_id;
+			move_seat(seat, event->x, event->y, &seat->touch_selection);
+			handle_selection_start(seat, &seat->touch_selection);
+		}
+		break;
+	case SELECTION_EVENT_TOUCH_MOTION:
+		if (seat->touch_id == event->touch_id) {
+			move_seat(seat, event->x, event->y, &seat->touch_selection);
+			handle_active_selection_motion(seat, &seat->touch_selection);
+			damage_seat(seat);
+		}
+		break;
+	case SELECTION_EVENT_TOUCH_UP:
+		handle_selection_end(seat, &seat->touch_selection);
+		touch_clear_state(seat);
+		break;
+	case SELECTION_EVENT_TOUCH_CANCEL:
+		touch_clear_state(seat);
+		break;
+	}
+}
+
+void selection_invalidate_hover(struct slurp_state *state) {
+	struct slurp_seat *seat;
+	wl_list_for_each(seat, &state->seats, link) {
+		seat->hover_valid = false;
+		// the boxes may be gone
+		seat->nav_box = NULL;
+		seat->nav_depth = 0;
+	}
+	state->forest_valid = false;
+	if (state->hints != NULL) {
+		hints_invalidate(state->hints);
+	}
+	selection_record_boxes_changed(state);
+}
+
+// Boxes were added, moved or removed in the given areas while the overlay
+// is shown. Only the seats whose hovered box may differ pick it again.
+// Hints are left to the caller, a move keeps them.
+void selection_boxes_changed(struct slurp_state *state,
+		const struct slurp_box *areas, size_t len) {
+	state->forest_valid = false;
+
+	struct slurp_seat *seat;
+	wl_list_for_each(seat, &state->seats, link) {
+		bool hit = !seat->hover_valid;
+		for (size_t i = 0; i < len && !hit; i++) {
+			hit = slurp_box_intersect(&seat->hover_region, &areas[i]);
+		}
+		if (!hit) {
+			continue;
+		}
+		seat->hover_valid = false;
+		if (seat->button_state != WL_POINTER_BUTTON_STATE_RELEASED ||
+				seat->pointer_selection.current_output == NULL) {
+			continue;
+		}
+		if (seat->pointer_selection.has_selection) {
+			damage_seat(seat);
+		}
+		seat_update_selection(seat);
+		if (seat->pointer_selection.has_selection) {
+			damage_seat(seat);
+		}
+	}
+}
+
+// Drops the references to a box that is about to be freed
+void selection_forget_box(struct slurp_state *state,
+		const struct slurp_box *box) {
+	struct slurp_seat *seat;
+	wl_list_for_each(seat, &state->seats, link) {
+		// the navigation path may go through the box
+		if (seat->nav_box == box || seat->nav_depth > 0) {
+			seat->nav_box = NULL;
+			seat->nav_depth = 0;
+		}
+		if (seat->pointer_selection.selection.label == box->label) {
+			seat->pointer_selection.selection.label = NULL;
+		}
+		if (seat->touch_selection.selection.label == box->label) {
+			seat->touch_selection.selection.label = NULL;
+		}
+	}
+	if (state->stream != NULL && state->stream->box.label == box->label) {
+		state->stream->box.label = NULL;
+	}
+}
+
+// Input sessions are recorded as text, one line per item:
+//
+//   config <single point> <restrict> <fixed aspect> <aspect ratio> <snap>
+//          <hints>
+//   boxes                         the box list and edges follow
+//   box <x> <y> <width> <height> [label]
+//   edges <x|y> <count> <edge>...
+//   <seat> enter|motion <x> <y>
+//   <seat> button <pressed>
+//   <seat> axis <-1|1>
+//   <seat> key <keysym> <pressed>
+//   <seat> touch-down|touch-motion <id> <x> <y>
+//   <seat> touch-up|touch-cancel <id>
+//
+// The boxes and edges are written again before the next event whenever
+// they change, so that a replay sees what the session saw. Changes made
+// through slurp_*_choice_box() are written as add, move and remove lines
+// instead, which the replay runs through the same functions.
+struct selection_recorder {
+	FILE *f;
+	bool boxes_dirty;
+};
+
+bool selection_record_open(struct slurp_state *state, const char *path) {
+	struct selection_recorder *recorder = calloc(1, sizeof(*recorder));
+	if (recorder == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return false;
+	}
+	recorder->f = fopen(path, "we");
+	if (recorder->f == NULL) {
+		free(recorder);
+		return false;
+	}
+	fprintf(recorder->f, "config %d %d %d %.17g %d %d\n", state->single_point,
+		state->restrict_selection, state->fixed_aspect_ratio,
+		state->aspect_ratio, state->snap_threshold, state->hints != NULL);
+	recorder->boxes_dirty = true;
+	state->recorder = recorder;
+	return true;
+}
+
+void selection_record_boxes_changed(struct slurp_state *state) {
+	if (state->recorder != NULL) {
+		state->recorder->boxes_dirty = true;
+	}
+}
+
+// edges shared by several boxes are followed by :count
+static void record_edges(FILE *f, char axis,
+		const struct slurp_edge_list *edges) {
+	fprintf(f, "edges %c %zu", axis, edges->len);
+	for (size_t i = 0; i < edges->len; i++) {
+		fprintf(f, " %d", edges->data[i]);
+		if (edges->counts[i] > 1) {
+			fprintf(f, ":%" PRIu32, edges->counts[i]);
+		}
+	}
+	fprintf(f, "\n");
+}
+
+static void record_box(FILE *f, const struct slurp_box *box) {
+	fprintf(f, " %d %d %d %d", box->x, box->y, box->width, box->height);
+	if (box->label != NULL) {
+		// labels end at the line
+		fprintf(f, " %.*s", (int)strcspn(box->label, "\n"), box->label);
+	}
+	fprintf(f, "\n");
+}
+
+static void record_boxes(struct slurp_state *state) {
+	FILE *f = state->recorder->f;
+	fprintf(f, "boxes\n");
+	struct slurp_box *box;
+	wl_list_for_each(box, &state->boxes, link) {
+		fprintf(f, "box");
+		record_box(f, box);
+	}
+	if (state->snap_edges.built) {
+		record_edges(f, 'x', &state->snap_edges.x);
+		record_edges(f, 'y', &state->snap_edges.y);
+	}
+	state->recorder->boxes_dirty = false;
+}
+
+static void record_event(struct slurp_seat *seat,
+		const struct selection_event *event) {
+	struct selection_recorder *recorder = seat->state->recorder;
+	if (recorder->boxes_dirty) {
+		record_boxes(seat->state);
+	}
+
+	FILE *f = recorder->f;
+	switch (event->type) {
+	case SELECTION_EVENT_POINTER_ENTER:
+		fprintf(f, "%d enter %d %d\n", seat->id, event->x, event->y);
+		break;
+	case SELECTION_EVENT_POINTER_MOTION:
+		fprintf(f, "%d motion %d %d\n", seat->id, event->x, event->y);
+		break;
+	case SELECTION_EVENT_POINTER_BUTTON:
+		fprintf(f, "%d button %d\n", seat->id, event->pressed);
+		break;
+	case SELECTION_EVENT_POINTER_AXIS:
+		fprintf(f, "%d axis %d\n", seat->id, event->y);
+		break;
+	case SELECTION_EVENT_KEY:
+		fprintf(f, "%d key %u %d\n", seat->id, event->keysym, event->pressed);
+		break;
+	case SELECTION_EVENT_TOUCH_DOWN:
+		fprintf(f, "%d touch-down %d %d %d\n", seat->id, event->touch_id,
+			event->x, event->y);
+		break;
+	case SELECTION_EVENT_TOUCH_MOTION:
+		fprintf(f, "%d touch-motion %d %d %d\n", seat->id, event->touch_id,
+			event->x, event->y);
+		break;
+	case SELECTION_EVENT_TOUCH_UP:
+		fprintf(f, "%d touch-up %d\n", seat->id, event->touch_id);
+		break;
+	case SELECTION_EVENT_TOUCH_CANCEL:
+		fprintf(f, "%d touch-cancel %d\n", seat->id, event->touch_id);
+		break;
+	}
+}
+
+// Whether a box change should be written, it's already part of the boxes
+// written before the next event otherwise
+static bool record_box_change(struct slurp_state *state) {
+	return state->recorder != NULL && !state->recorder->boxes_dirty;
+}
+
+// the position of a box in the list, which the replay finds it by
+static size_t box_index(struct slurp_state *state,
+		const struct slurp_box *box) {
+	size_t i = 0;
+	struct slurp_box *b;
+	wl_list_for_each(b, &state->boxes, link) {
+		if (b == box) {
+			break;
+		}
+		i++;
+	}
+	return i;
+}
+
+void selection_record_add(struct slurp_state *state,
+		const struct slurp_box *box) {
+	if (record_box_change(state)) {
+		fprintf(state->recorder->f, "add");
+		record_box(state->recorder->f, box);
+	}
+}
+
+void selection_record_move(struct slurp_state *state,
+		const struct slurp_box *box, const struct slurp_box *geometry) {
+	if (record_box_change(state)) {
+		fprintf(state->recorder->f, "move %zu %d %d %d %d\n",
+			box_index(state, box), geometry->x, geometry->y,
+			geometry->width, geometry->height);
+	}
+}
+
+void selection_record_remove(struct slurp_state *state,
+		const struct slurp_box *box) {
+	if (record_box_change(state)) {
+		fprintf(state->recorder->f, "remove %zu\n", box_index(state, box));
+	}
+}
+
+void selection_record_leave(struct slurp_seat *seat) {
+	struct selection_recorder *recorder = seat->state->recorder;
+	if (recorder == NULL) {
+		return;
+	}
+	if (recorder->boxes_dirty) {
+		record_boxes(seat->state);
+	}
+	fprintf(recorder->f, "%d leave\n", seat->id);
+}
+
+void selection_record_close(struct slurp_state *state) {
+	if (state->recorder == NULL) {
+		return;
+	}
+	fclose(state->recorder->f);
+	free(state->recorder);
+	state->recorder = NULL;
+}
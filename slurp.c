@@ -1,22 +1,37 @@
 #define _POSIX_C_SOURCE 200809L
 
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 #include <wayland-cursor.h>
 #include <xkbcommon/xkbcommon.h>
 #include <linux/input-event-codes.h>
 
 #include "wlr-layer-shell-unstable-v1-client-protocol.h"
+#include "wlr-screencopy-unstable-v1-client-protocol.h"
 #include "xdg-output-unstable-v1-client-protocol.h"
 
+#include "alloc-stats.h"
+#include "control.h"
+#include "fill.h"
+#include "hint.h"
+#include "frame-stats.h"
+#include "keymap.h"
+#include "output-index.h"
 #include "pool-buffer.h"
 #include "slurp.h"
 #include "render.h"
+#include "selection.h"
+#include "stream.h"
+#include "sway-ipc.h"
+#include "tile-pool.h"
 
-#define TOUCH_ID_EMPTY -1
 #define BG_COLOR 0xFFFFFF40
 #define BORDER_COLOR 0x000000FF
 #define SELECTION_COLOR 0x00000000
@@ -27,127 +42,75 @@ static void noop() {
 }
 
 static void set_output_dirty(struct slurp_output *output);
-
-static int32_t box_size(const struct slurp_box *box) {
-	return box->width * box->height;
-}
-
-static bool in_box(const struct slurp_box *box, int32_t x, int32_t y) {
-	return box->x <= x
-		&& box->x + box->width > x
-		&& box->y <= y
-		&& box->y + box->height > y;
-}
+static void prepare_first_frame(struct slurp_output *output);
+static void create_output_surface(struct slurp_output *output);
+static bool load_output_cursor(struct slurp_output *output);
+static void choose_output(struct slurp_state *state,
+	struct slurp_output *output);
 
 static int max(int a, int b) {
 	return (a > b) ? a : b;
 }
 
+static int min(int a, int b) {
+	return (a < b) ? a : b;
+}
+
 static struct slurp_output *output_from_surface(struct slurp_state *state,
 	struct wl_surface *surface);
 
-static void move_seat(struct slurp_seat *seat, wl_fixed_t surface_x,
-		wl_fixed_t surface_y,
-		struct slurp_selection *current_selection) {
-	int x = wl_fixed_to_int(surface_x) +
-		current_selection->current_output->logical_geometry.x;
-	int y = wl_fixed_to_int(surface_y) + current_selection->current_output->logical_geometry.y;
-
-	if (seat->state->edit_anchor) {
-		current_selection->anchor_x += x - current_selection->x;
-		current_selection->anchor_y += y - current_selection->y;
-	}
-
-	current_selection->x = x;
-	current_selection->y = y;
+static uint64_t now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
-static void seat_update_selection(struct slurp_seat *seat) {
-	seat->pointer_selection.has_selection = false;
-
-	// find smallest box intersecting the cursor
-	struct slurp_box *box;
-	wl_list_for_each(box, &seat->state->boxes, link) {
-		if (in_box(box, seat->pointer_selection.x,
-			   seat->pointer_selection.y)) {
-			if (seat->pointer_selection.has_selection &&
-				box_size(
-					&seat->pointer_selection.selection) <
-					box_size(box)) {
-				continue;
-			}
-			seat->pointer_selection.selection = *box;
-			seat->pointer_selection.has_selection = true;
-		}
-	}
+static void output_index_set_dirty(struct slurp_output *output, void *data) {
+	set_output_dirty(output);
 }
 
 static void seat_set_outputs_dirty(struct slurp_seat *seat) {
-	struct slurp_output *output;
-	wl_list_for_each(output, &seat->state->outputs, link) {
-		if (slurp_box_intersect(&output->logical_geometry,
-			&seat->pointer_selection.selection) ||
-				slurp_box_intersect(&output->logical_geometry,
-			&seat->touch_selection.selection)) {
-			set_output_dirty(output);
-		}
-	}
+	struct slurp_box selections[] = {
+		seat->pointer_selection.selection,
+		seat->touch_selection.selection,
+	};
+	output_index_for_each(seat->state, selections, 2,
+		output_index_set_dirty, NULL);
 }
 
-static void handle_active_selection_motion(struct slurp_seat *seat, struct slurp_selection *current_selection) {
-	if(seat->state->restrict_selection){
-		return;
-	}
-
-	int32_t anchor_x = current_selection->anchor_x;
-	int32_t anchor_y = current_selection->anchor_y;
-	int32_t dist_x = current_selection->x - anchor_x;
-	int32_t dist_y = current_selection->y - anchor_y;
-
-	current_selection->has_selection = true;
-	// selection includes the seat and anchor positions
-	int32_t width = abs(dist_x) + 1;
-	int32_t height = abs(dist_y) + 1;
-	if (seat->state->aspect_ratio) {
-		width = max(width, height / seat->state->aspect_ratio);
-		height = max(height, width * seat->state->aspect_ratio);
-	}
-	current_selection->selection.x = dist_x > 0 ? anchor_x : anchor_x - (width - 1);
-	current_selection->selection.y = dist_y > 0 ? anchor_y : anchor_y - (height - 1);
-	current_selection->selection.width = width;
-	current_selection->selection.height = height;
+static void boxes_set_outputs_dirty(struct slurp_state *state,
+		const struct slurp_box *boxes, size_t len) {
+	output_index_for_each(state, boxes, len, output_index_set_dirty, NULL);
 }
 
 static void pointer_handle_enter(void *data, struct wl_pointer *wl_pointer,
 		uint32_t serial, struct wl_surface *surface,
 		wl_fixed_t surface_x, wl_fixed_t surface_y) {
 	struct slurp_seat *seat = data;
-	struct slurp_output *output = output_from_surface(seat->state, surface);
+	struct slurp_state *state = seat->state;
+	struct slurp_output *output = output_from_surface(state, surface);
 	if (output == NULL) {
 		return;
 	}
 
-	// the places the cursor moved away from are also dirty
-	if (seat->pointer_selection.has_selection) {
-		seat_set_outputs_dirty(seat);
+	if (state->pointer_output && state->chosen_output == NULL) {
+		choose_output(state, output);
 	}
 
 	// TODO: handle multiple overlapping outputs
 	seat->pointer_selection.current_output = output;
 
-	move_seat(seat, surface_x, surface_y, &seat->pointer_selection);
+	struct selection_event event = {
+		.type = SELECTION_EVENT_POINTER_ENTER,
+		.x = wl_fixed_to_int(surface_x) + output->logical_geometry.x,
+		.y = wl_fixed_to_int(surface_y) + output->logical_geometry.y,
+	};
+	selection_handle_event(seat, &event);
 
-	switch (seat->button_state) {
-	case WL_POINTER_BUTTON_STATE_RELEASED:
-		seat_update_selection(seat);
-		break;
-	case WL_POINTER_BUTTON_STATE_PRESSED:;
-		handle_active_selection_motion(seat, &seat->pointer_selection);
-		break;
+	if (output->cursor_theme == NULL && !load_output_cursor(output)) {
+		state->running = false;
+		return;
 	}
-
-	seat_set_outputs_dirty(seat);
-
 	wl_surface_set_buffer_scale(seat->cursor_surface, output->scale);
 	wl_surface_attach(seat->cursor_surface,
 			wl_cursor_image_get_buffer(output->cursor_image), 0, 0);
@@ -163,81 +126,103 @@ static void pointer_handle_leave(void *data, struct wl_pointer *wl_pointer,
 
 	// TODO: handle multiple overlapping outputs
 	seat->pointer_selection.current_output = NULL;
+	seat->axis_pending = 0;
+	selection_record_leave(seat);
 }
 
 static void pointer_handle_motion(void *data, struct wl_pointer *wl_pointer,
 		uint32_t time, wl_fixed_t surface_x, wl_fixed_t surface_y) {
 	struct slurp_seat *seat = data;
-	// the places the cursor moved away from are also dirty
-	if (seat->pointer_selection.has_selection) {
-		seat_set_outputs_dirty(seat);
+	struct slurp_output *output = seat->pointer_selection.current_output;
+	if (output == NULL) {
+		return;
 	}
 
-	move_seat(seat, surface_x, surface_y, &seat->pointer_selection);
+	frame_stats_motion();
+	struct selection_event event = {
+		.type = SELECTION_EVENT_POINTER_MOTION,
+		.x = wl_fixed_to_int(surface_x) + output->logical_geometry.x,
+		.y = wl_fixed_to_int(surface_y) + output->logical_geometry.y,
+	};
+	selection_handle_event(seat, &event);
+}
 
-	switch (seat->button_state) {
-	case WL_POINTER_BUTTON_STATE_RELEASED:
-		seat_update_selection(seat);
-		break;
-	case WL_POINTER_BUTTON_STATE_PRESSED:;
-		handle_active_selection_motion(seat, &seat->pointer_selection);
-		break;
+static void pointer_handle_button(void *data, struct wl_pointer *wl_pointer,
+		uint32_t serial, uint32_t time, uint32_t button,
+		uint32_t button_state) {
+	struct slurp_seat *seat = data;
+	struct selection_event event = {
+		.type = SELECTION_EVENT_POINTER_BUTTON,
+		.pressed = button_state == WL_POINTER_BUTTON_STATE_PRESSED,
+	};
+	selection_handle_event(seat, &event);
+}
+
+// scroll distance of a wheel click on most compositors
+#define AXIS_STEP 15
+
+static void seat_scroll(struct slurp_seat *seat, int32_t direction) {
+	struct selection_event event = {
+		.type = SELECTION_EVENT_POINTER_AXIS,
+		.y = direction,
+	};
+	selection_handle_event(seat, &event);
+}
+
+static void pointer_handle_axis(void *data, struct wl_pointer *wl_pointer,
+		uint32_t time, uint32_t axis, wl_fixed_t value) {
+	struct slurp_seat *seat = data;
+	if (axis != WL_POINTER_AXIS_VERTICAL_SCROLL) {
+		return;
+	}
+	// wheel clicks are counted by axis_discrete. Seats older than version 5
+	// send neither it nor the source, their wheels are handled below.
+	if (seat->axis_discrete ||
+			seat->axis_source == WL_POINTER_AXIS_SOURCE_WHEEL ||
+			seat->axis_source == WL_POINTER_AXIS_SOURCE_WHEEL_TILT) {
+		return;
 	}
 
-	if (seat->pointer_selection.has_selection) {
-		seat_set_outputs_dirty(seat);
+	// touchpads scroll in small steps, move once per wheel click worth
+	seat->axis_pending += wl_fixed_to_double(value);
+	while (seat->axis_pending <= -AXIS_STEP ||
+			seat->axis_pending >= AXIS_STEP) {
+		int32_t direction = seat->axis_pending < 0 ? -1 : 1;
+		seat->axis_pending -= direction * AXIS_STEP;
+		seat_scroll(seat, direction);
 	}
 }
 
-static void handle_selection_start(struct slurp_seat *seat,
-				   struct slurp_selection *current_selection) {
-	struct slurp_state *state = seat->state;
+static void pointer_handle_frame(void *data, struct wl_pointer *wl_pointer) {
+	struct slurp_seat *seat = data;
+	seat->axis_source = -1;
+	seat->axis_discrete = false;
+}
 
-	if (state->single_point) {
-		state->result.x = current_selection->x;
-		state->result.y = current_selection->y;
-		state->result.width = state->result.height = 1;
-		state->running = false;
-	} else if (state->restrict_selection) {
-		if (current_selection->has_selection) {
-			state->result = current_selection->selection;
-			state->running = false;
-		}
-	} else {
-		current_selection->anchor_x = current_selection->x;
-		current_selection->anchor_y = current_selection->y;
-	}
+static void pointer_handle_axis_source(void *data,
+		struct wl_pointer *wl_pointer, uint32_t axis_source) {
+	struct slurp_seat *seat = data;
+	seat->axis_source = axis_source;
 }
 
-static void handle_selection_end(struct slurp_seat *seat,
-				 struct slurp_selection *current_selection) {
-	struct slurp_state *state = seat->state;
-	if (state->single_point || state->restrict_selection) {
-		return;
-	}
-	if (current_selection->has_selection) {
-		state->result = current_selection->selection;
+static void pointer_handle_axis_stop(void *data, struct wl_pointer *wl_pointer,
+		uint32_t time, uint32_t axis) {
+	struct slurp_seat *seat = data;
+	if (axis == WL_POINTER_AXIS_VERTICAL_SCROLL) {
+		seat->axis_pending = 0;
 	}
-	state->running = false;
 }
 
-static void pointer_handle_button(void *data, struct wl_pointer *wl_pointer,
-		uint32_t serial, uint32_t time, uint32_t button,
-		uint32_t button_state) {
+static void pointer_handle_axis_discrete(void *data,
+		struct wl_pointer *wl_pointer, uint32_t axis, int32_t discrete) {
 	struct slurp_seat *seat = data;
-	if (seat->touch_selection.has_selection) {
+	if (axis != WL_POINTER_AXIS_VERTICAL_SCROLL) {
 		return;
 	}
-
-	seat->button_state = button_state;
-
-	switch (button_state) {
-	case WL_POINTER_BUTTON_STATE_PRESSED:
-		handle_selection_start(seat, &seat->pointer_selection);
-		break;
-	case WL_POINTER_BUTTON_STATE_RELEASED:
-		handle_selection_end(seat, &seat->pointer_selection);
-		break;
+	seat->axis_discrete = true;
+	int32_t direction = discrete < 0 ? -1 : 1;
+	for (int32_t i = 0; i != discrete; i += direction) {
+		seat_scroll(seat, direction);
 	}
 }
 
@@ -246,7 +231,11 @@ static const struct wl_pointer_listener pointer_listener = {
 	.leave = pointer_handle_leave,
 	.motion = pointer_handle_motion,
 	.button = pointer_handle_button,
-	.axis = noop,
+	.axis = pointer_handle_axis,
+	.frame = pointer_handle_frame,
+	.axis_source = pointer_handle_axis_source,
+	.axis_stop = pointer_handle_axis_stop,
+	.axis_discrete = pointer_handle_axis_discrete,
 };
 
 static void keyboard_handle_keymap(void *data, struct wl_keyboard *wl_keyboard,
@@ -254,7 +243,7 @@ static void keyboard_handle_keymap(void *data, struct wl_keyboard *wl_keyboard,
 	struct slurp_seat *seat = data;
 	switch (format) {
 	case WL_KEYBOARD_KEYMAP_FORMAT_NO_KEYMAP:
-		seat->xkb_keymap = xkb_keymap_new_from_names(seat->state->xkb_context, NULL, XKB_KEYMAP_COMPILE_NO_FLAGS);
+		seat->keymap = keymap_from_names(seat->state);
 		break;
 	case WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1:;
 		void *buffer;
@@ -262,80 +251,26 @@ static void keyboard_handle_keymap(void *data, struct wl_keyboard *wl_keyboard,
 			fprintf(stderr, "mmap failed\n");
 			exit(EXIT_FAILURE);
 		}
-		seat->xkb_keymap =
-			xkb_keymap_new_from_buffer(seat->state->xkb_context,
-					buffer, size - 1,
-					XKB_KEYMAP_FORMAT_TEXT_V1,
-					XKB_KEYMAP_COMPILE_NO_FLAGS);
+		seat->keymap = keymap_from_buffer(seat->state, buffer, size - 1);
 		munmap(buffer, size - 1);
 		close(fd);
 		break;
 	}
-	seat->xkb_state = xkb_state_new(seat->xkb_keymap);
-}
-
-// Recompute the selection if the aspect ratio changed.
-static void recompute_selection(struct slurp_seat *seat) {
-	struct slurp_selection *current = slurp_seat_current_selection(seat);
-	if (current->has_selection) {
-		handle_active_selection_motion(seat, slurp_seat_current_selection(seat));
-		seat_set_outputs_dirty(seat);
-	}
 }
 
 static void keyboard_handle_key(void *data, struct wl_keyboard *wl_keyboard,
 		const uint32_t serial, const uint32_t time, const uint32_t key,
 		const uint32_t key_state) {
 	struct slurp_seat *seat = data;
-	struct slurp_state *state = seat->state;
-	const xkb_keysym_t keysym = xkb_state_key_get_one_sym(seat->xkb_state, key + 8);
-
-	switch (key_state) {
-	case WL_KEYBOARD_KEY_STATE_PRESSED:
-		switch (keysym) {
-		case XKB_KEY_Escape:
-			seat->pointer_selection.has_selection = false;
-			seat->touch_selection.has_selection = false;
-			state->edit_anchor = false;
-			state->running = false;
-			break;
-
-		case XKB_KEY_space:
-			if (!seat->pointer_selection.has_selection &&
-					!seat->touch_selection.has_selection) {
-				break;
-			}
-			state->edit_anchor = true;
-			break;
-		case XKB_KEY_Shift_L:
-		case XKB_KEY_Shift_R:
-			if (!state->fixed_aspect_ratio) {
-				state->aspect_ratio = 1;
-				recompute_selection(seat);
-			}
-			break;
-		}
-		break;
-
-	case WL_KEYBOARD_KEY_STATE_RELEASED:
-		if (keysym == XKB_KEY_space) {
-			state->edit_anchor = false;
-		} else if (!state->fixed_aspect_ratio && (keysym == XKB_KEY_Shift_L || keysym == XKB_KEY_Shift_R)) {
-			state->aspect_ratio = 0;
-			recompute_selection(seat);
-		}
-		break;
+	if (seat->keymap == NULL) {
+		return;
 	}
-
-}
-
-static void keyboard_handle_modifiers(void *data, struct wl_keyboard *wl_keyboard,
-		const uint32_t serial, const uint32_t mods_depressed,
-		const uint32_t mods_latched, const uint32_t mods_locked,
-		const uint32_t group) {
-	struct slurp_seat *seat = data;
-	xkb_state_update_mask(seat->xkb_state, mods_depressed, mods_latched,
-			mods_locked, 0, 0, group);
+	struct selection_event event = {
+		.type = SELECTION_EVENT_KEY,
+		.keysym = keymap_get_keysym(seat->keymap, key + 8),
+		.pressed = key_state == WL_KEYBOARD_KEY_STATE_PRESSED,
+	};
+	selection_handle_event(seat, &event);
 }
 
 static const struct wl_keyboard_listener keyboard_listener = {
@@ -343,7 +278,8 @@ static const struct wl_keyboard_listener keyboard_listener = {
 	.enter = noop,
 	.leave = noop,
 	.key = keyboard_handle_key,
-	.modifiers = keyboard_handle_modifiers,
+	.modifiers = noop,
+	.repeat_info = noop,
 };
 
 static void touch_handle_down(void *data, struct wl_touch *touch,
@@ -351,44 +287,60 @@ static void touch_handle_down(void *data, struct wl_touch *touch,
 		struct wl_surface *surface, int32_t id,
 		wl_fixed_t x, wl_fixed_t y) {
 	struct slurp_seat *seat = data;
-	if (seat->pointer_selection.has_selection) {
+	struct slurp_output *output = output_from_surface(seat->state, surface);
+	if (output == NULL || seat->pointer_selection.has_selection ||
+			seat->touch_id != TOUCH_ID_EMPTY) {
 		return;
 	}
-	if (seat->touch_id == TOUCH_ID_EMPTY) {
-		seat->touch_id = id;
-		seat->touch_selection.current_output =
-			output_from_surface(seat->state, surface);
-		move_seat(seat, x, y, &seat->touch_selection);
-		handle_selection_start(seat, &seat->touch_selection);
+	if (seat->state->pointer_output && seat->state->chosen_output == NULL) {
+		choose_output(seat->state, output);
 	}
-}
-
-static void touch_clear_state(struct slurp_seat *seat) {
-	seat->touch_id = TOUCH_ID_EMPTY;
-	seat->touch_selection.current_output = NULL;
+	seat->touch_selection.current_output = output;
+
+	struct selection_event event = {
+		.type = SELECTION_EVENT_TOUCH_DOWN,
+		.x = wl_fixed_to_int(x) + output->logical_geometry.x,
+		.y = wl_fixed_to_int(y) + output->logical_geometry.y,
+		.touch_id = id,
+	};
+	selection_handle_event(seat, &event);
 }
 
 static void touch_handle_up(void *data, struct wl_touch *touch, uint32_t serial,
 		uint32_t time, int32_t id) {
 	struct slurp_seat *seat = data;
-	handle_selection_end(seat, &seat->touch_selection);
-	touch_clear_state(seat);
+	struct selection_event event = {
+		.type = SELECTION_EVENT_TOUCH_UP,
+		.touch_id = id,
+	};
+	selection_handle_event(seat, &event);
 }
 
 static void touch_handle_motion(void *data, struct wl_touch *touch,
 		uint32_t time, int32_t id, wl_fixed_t x,
 		wl_fixed_t y) {
 	struct slurp_seat *seat = data;
-	if (seat->touch_id == id) {
-		move_seat(seat, x, y, &seat->touch_selection);
-		handle_active_selection_motion(seat, &seat->touch_selection);
-		seat_set_outputs_dirty(seat);
+	struct slurp_output *output = seat->touch_selection.current_output;
+	if (seat->touch_id != id || output == NULL) {
+		return;
 	}
+	frame_stats_motion();
+	struct selection_event event = {
+		.type = SELECTION_EVENT_TOUCH_MOTION,
+		.x = wl_fixed_to_int(x) + output->logical_geometry.x,
+		.y = wl_fixed_to_int(y) + output->logical_geometry.y,
+		.touch_id = id,
+	};
+	selection_handle_event(seat, &event);
 }
 
 static void touch_handle_cancel(void *data, struct wl_touch *touch) {
 	struct slurp_seat *seat = data;
-	touch_clear_state(seat);
+	struct selection_event event = {
+		.type = SELECTION_EVENT_TOUCH_CANCEL,
+		.touch_id = seat->touch_id,
+	};
+	selection_handle_event(seat, &event);
 }
 
 static const struct wl_touch_listener touch_listener = {
@@ -421,6 +373,7 @@ static void seat_handle_capabilities(void *data, struct wl_seat *wl_seat,
 
 static const struct wl_seat_listener seat_listener = {
 	.capabilities = seat_handle_capabilities,
+	.name = noop,
 };
 
 static void create_seat(struct slurp_state *state, struct wl_seat *wl_seat) {
@@ -432,6 +385,8 @@ static void create_seat(struct slurp_state *state, struct wl_seat *wl_seat) {
 	seat->state = state;
 	seat->wl_seat = wl_seat;
 	seat->touch_id = TOUCH_ID_EMPTY;
+	seat->axis_source = -1;
+	seat->id = wl_list_length(&state->seats);
 	wl_list_insert(&state->seats, &seat->link);
 	wl_seat_add_listener(wl_seat, &seat_listener, seat);
 }
@@ -445,8 +400,6 @@ static void destroy_seat(struct slurp_seat *seat) {
 	if (seat->wl_keyboard) {
 		wl_keyboard_destroy(seat->wl_keyboard);
 	}
-	xkb_state_unref(seat->xkb_state);
-	xkb_keymap_unref(seat->xkb_keymap);
 	wl_seat_destroy(seat->wl_seat);
 	free(seat);
 }
@@ -478,11 +431,261 @@ static void output_handle_scale(void *data, struct wl_output *wl_output,
 	output->scale = scale;
 }
 
+static void output_set_name(struct slurp_output *output, const char *name) {
+	free(output->logical_geometry.label);
+	output->logical_geometry.label = strdup(name);
+}
+
+static void output_handle_name(void *data, struct wl_output *wl_output,
+		const char *name) {
+	struct slurp_output *output = data;
+	output_set_name(output, name);
+}
+
+static bool load_output_cursor(struct slurp_output *output) {
+	struct slurp_state *state = output->state;
+	output->cursor_theme = wl_cursor_theme_load(state->cursor_theme,
+		state->cursor_size * output->scale, state->shm);
+	if (output->cursor_theme == NULL) {
+		state->error = "failed to load cursor theme";
+		return false;
+	}
+	struct wl_cursor *cursor =
+		wl_cursor_theme_get_cursor(output->cursor_theme, "crosshair");
+	if (cursor == NULL) {
+		// Fallback
+		cursor =
+			wl_cursor_theme_get_cursor(output->cursor_theme, "left_ptr");
+	}
+	if (cursor == NULL) {
+		state->error = "failed to load cursor";
+		return false;
+	}
+	output->cursor_image = cursor->images[0];
+	return true;
+}
+
+static bool output_geometry_ready(struct slurp_output *output) {
+	return output->wl_output_done &&
+		(output->xdg_output == NULL || output->xdg_output_done);
+}
+
+static bool output_name_matches(const char *names, const char *name) {
+	size_t len = strlen(name);
+	const char *c = names;
+	while (true) {
+		const char *end = c + strcspn(c, ",");
+		if ((size_t)(end - c) == len && strncmp(c, name, len) == 0) {
+			return true;
+		}
+		if (*end == '\0') {
+			return false;
+		}
+		c = end + 1;
+	}
+}
+
+// Whether the overlay is shown on the output, with -P every output is a
+// candidate until the pointer enters one.
+static bool output_is_chosen(struct slurp_output *output) {
+	struct slurp_state *state = output->state;
+	if (state->pointer_output) {
+		return state->chosen_output == NULL || state->chosen_output == output;
+	} else if (state->output_names != NULL) {
+		return output->logical_geometry.label != NULL &&
+			output_name_matches(state->output_names,
+				output->logical_geometry.label);
+	}
+	return true;
+}
+
+// Clips the box to the chosen output it overlaps the most, returns false if
+// it is outside of all of them.
+static bool clip_box_to_outputs(struct slurp_state *state,
+		struct slurp_box *box) {
+	struct slurp_box clipped = {0};
+	int64_t clipped_size = 0;
+	struct slurp_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		if (!output_is_chosen(output) || !output_geometry_ready(output)) {
+			continue;
+		}
+		const struct slurp_box *g = &output->logical_geometry;
+		int32_t x1 = max(box->x, g->x);
+		int32_t y1 = max(box->y, g->y);
+		int32_t x2 = min(box->x + box->width, g->x + g->width);
+		int32_t y2 = min(box->y + box->height, g->y + g->height);
+		int64_t size = (int64_t)(x2 - x1) * (y2 - y1);
+		if (x2 > x1 && y2 > y1 && size > clipped_size) {
+			clipped_size = size;
+			clipped.x = x1;
+			clipped.y = y1;
+			clipped.width = x2 - x1;
+			clipped.height = y2 - y1;
+		}
+	}
+	if (clipped_size == 0) {
+		return false;
+	}
+	box->x = clipped.x;
+	box->y = clipped.y;
+	box->width = clipped.width;
+	box->height = clipped.height;
+	return true;
+}
+
+// Clips the box from its requested geometry, returns false if it is
+// outside of all of the chosen outputs.
+static bool clip_choice_box(struct slurp_state *state, struct slurp_box *box) {
+	box->x = box->requested.x;
+	box->y = box->requested.y;
+	box->width = box->requested.width;
+	box->height = box->requested.height;
+	return clip_box_to_outputs(state, box);
+}
+
+// Frees a box already taken out of the list
+static void free_choice_box(struct slurp_state *state, struct slurp_box *box) {
+	if (box->id != 0 && state->control != NULL) {
+		control_forget(state->control, box);
+	}
+	selection_forget_box(state, box);
+	free(box->label);
+	free(box);
+}
+
+// Clips the choice boxes to the chosen outputs, the ones outside of all of
+// them are hidden.
+static void clip_boxes(struct slurp_state *state) {
+	state->boxes_clipped = true;
+
+	struct slurp_box *box, *box_tmp;
+	wl_list_for_each_safe(box, box_tmp, &state->boxes, link) {
+		struct slurp_box orig = *box;
+		if (!clip_choice_box(state, box)) {
+			selection_remove_snap_edges(state, &orig);
+			selection_forget_box(state, box);
+			wl_list_remove(&box->link);
+			wl_list_insert(state->hidden_boxes.prev, &box->link);
+			box->hidden = true;
+			continue;
+		}
+		if (box->x != orig.x || box->y != orig.y ||
+				box->width != orig.width || box->height != orig.height) {
+			selection_remove_snap_edges(state, &orig);
+			selection_insert_snap_edges(state, box);
+		}
+	}
+
+	// cached labels are at the unclipped positions
+	struct slurp_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		render_invalidate_labels(output);
+		if (output->surface != NULL && output->configured) {
+			set_output_dirty(output);
+		}
+	}
+
+	// selections may point to the labels of hidden boxes
+	selection_invalidate_hover(state);
+	struct slurp_seat *seat;
+	wl_list_for_each(seat, &state->seats, link) {
+		if (seat->button_state == WL_POINTER_BUTTON_STATE_RELEASED) {
+			seat->pointer_selection.has_selection = false;
+		}
+	}
+}
+
+// With -O, clips the boxes once the names of all outputs are known.
+static void clip_named_outputs(struct slurp_state *state) {
+	if (state->output_names == NULL || state->boxes_clipped) {
+		return;
+	}
+	bool found = false;
+	struct slurp_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		if (!output_geometry_ready(output)) {
+			return;
+		}
+		found = found || output_is_chosen(output);
+	}
+	if (!found) {
+		state->error = "no output matches the given names";
+		state->running = false;
+		return;
+	}
+	clip_boxes(state);
+}
+
+// Called once all of the output's geometry has been received. Nothing
+// waits for this with a roundtrip: the layer surfaces are created while
+// these events are still in flight.
+static void output_handle_geometry_done(struct slurp_output *output) {
+	struct slurp_state *state = output->state;
+	if (!output_geometry_ready(output)) {
+		return;
+	}
+
+	if (output->xdg_output == NULL) {
+		// guess
+		char *name = output->logical_geometry.label;
+		output->logical_geometry = output->geometry;
+		output->logical_geometry.width /= output->scale;
+		output->logical_geometry.height /= output->scale;
+		output->logical_geometry.label = name;
+	}
+	output_index_invalidate(state);
+
+	if (state->resolve_only) {
+		return;
+	}
+
+	if (!output_is_chosen(output)) {
+		clip_named_outputs(state);
+		return;
+	}
+
+	// with -P, cursors are only loaded for the output the pointer enters
+	if (!state->pointer_output && output->cursor_theme == NULL &&
+			!load_output_cursor(output)) {
+		state->running = false;
+		return;
+	}
+
+	if (state->output_names != NULL && output->surface == NULL) {
+		create_output_surface(output);
+	}
+
+	if (state->output_boxes && !output->has_output_box) {
+		output->has_output_box = true;
+		slurp_add_choice_box(state, &output->logical_geometry);
+	}
+	selection_insert_snap_edges(state, &output->logical_geometry);
+	selection_record_boxes_changed(state);
+
+	render_invalidate_labels(output);
+	if (output->surface != NULL && output->configured) {
+		set_output_dirty(output);
+	} else {
+		prepare_first_frame(output);
+	}
+
+	clip_named_outputs(state);
+}
+
+static void output_handle_done(void *data, struct wl_output *wl_output) {
+	struct slurp_output *output = data;
+	output->wl_output_done = true;
+	output_handle_geometry_done(output);
+}
+
 static const struct wl_output_listener output_listener = {
 	.geometry = output_handle_geometry,
 	.mode = output_handle_mode,
-	.done = noop,
+	.done = output_handle_done,
 	.scale = output_handle_scale,
+	.name = output_handle_name,
+	.description = noop,
 };
 
 static void xdg_output_handle_logical_position(void *data,
@@ -501,13 +704,20 @@ static void xdg_output_handle_logical_size(void *data,
 
 static void xdg_output_handle_name(void *data, struct zxdg_output_v1 *xdg_output, const char *name) {
 	struct slurp_output *output = data;
-	output->logical_geometry.label = strdup(name);
+	output_set_name(output, name);
+}
+
+static void xdg_output_handle_done(void *data,
+		struct zxdg_output_v1 *xdg_output) {
+	struct slurp_output *output = data;
+	output->xdg_output_done = true;
+	output_handle_geometry_done(output);
 }
 
 static const struct zxdg_output_v1_listener xdg_output_listener = {
 	.logical_position = xdg_output_handle_logical_position,
 	.logical_size = xdg_output_handle_logical_size,
-	.done = noop,
+	.done = xdg_output_handle_done,
 	.name = xdg_output_handle_name,
 	.description = noop,
 };
@@ -527,6 +737,9 @@ static void create_output(struct slurp_state *state,
 	output->wl_output = wl_output;
 	output->state = state;
 	output->scale = 1;
+	// older outputs don't send done, rely on xdg-output's instead
+	output->wl_output_done =
+		wl_output_get_version(wl_output) < WL_OUTPUT_DONE_SINCE_VERSION;
 	wl_list_insert(&state->outputs, &output->link);
 
 	wl_output_add_listener(wl_output, &output_listener, output);
@@ -537,14 +750,23 @@ static void destroy_output(struct slurp_output *output) {
 		return;
 	}
 	wl_list_remove(&output->link);
+	output_index_invalidate(output->state);
 	finish_buffer(&output->buffers[0]);
 	finish_buffer(&output->buffers[1]);
-	wl_cursor_theme_destroy(output->cursor_theme);
-	zwlr_layer_surface_v1_destroy(output->layer_surface);
+	render_finish(output);
+	// themes are loaded on first use
+	if (output->cursor_theme != NULL) {
+		wl_cursor_theme_destroy(output->cursor_theme);
+	}
+	if (output->layer_surface) {
+		zwlr_layer_surface_v1_destroy(output->layer_surface);
+	}
 	if (output->xdg_output) {
 		zxdg_output_v1_destroy(output->xdg_output);
 	}
-	wl_surface_destroy(output->surface);
+	if (output->surface) {
+		wl_surface_destroy(output->surface);
+	}
 	if (output->frame_callback) {
 		wl_callback_destroy(output->frame_callback);
 	}
@@ -554,6 +776,94 @@ static void destroy_output(struct slurp_output *output) {
 	free(output);
 }
 
+struct slurp_idle_buffer {
+	struct pool_buffer buffer;
+	int32_t scale;
+	struct wl_list link; // slurp_state::idle_buffers
+};
+
+// An output is idle when it only shows the background
+static bool output_is_idle(struct slurp_output *output) {
+	struct slurp_state *state = output->state;
+	struct slurp_box *box;
+	wl_list_for_each(box, &state->boxes, link) {
+		if (slurp_box_intersect(&output->logical_geometry, box)) {
+			return false;
+		}
+	}
+	struct slurp_seat *seat;
+	wl_list_for_each(seat, &state->seats, link) {
+		struct slurp_selection *selection = slurp_seat_current_selection(seat);
+		if (selection->has_selection &&
+				slurp_box_intersect(&output->logical_geometry,
+					&selection->selection)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// The idle buffers are never drawn to again after their first render, so
+// they can stay attached to any number of surfaces at once.
+static struct pool_buffer *get_idle_buffer(struct slurp_state *state,
+		uint32_t width, uint32_t height, int32_t scale, size_t *pixels) {
+	struct slurp_idle_buffer *idle;
+	wl_list_for_each(idle, &state->idle_buffers, link) {
+		if (idle->buffer.width == width && idle->buffer.height == height &&
+				idle->scale == scale) {
+			return &idle->buffer;
+		}
+	}
+
+	idle = calloc(1, sizeof(*idle));
+	if (idle == NULL) {
+		fprintf(stderr, "allocation failed\n");
+		return NULL;
+	}
+	if (get_buffer(state->shm, &idle->buffer, width, height) == NULL) {
+		free(idle);
+		return NULL;
+	}
+	idle->scale = scale;
+	*pixels = render_background(state, &idle->buffer);
+	wl_list_insert(&state->idle_buffers, &idle->link);
+	return &idle->buffer;
+}
+
+// The surface is anchored to all edges, so the first configure most likely
+// asks for the output's logical size. Draw the first frame into a buffer of
+// that size while waiting for it. send_frame() then picks the same buffer,
+// finds all tiles up to date and only has to commit.
+static void prepare_first_frame(struct slurp_output *output) {
+	struct slurp_state *state = output->state;
+	if (output->surface == NULL || output->configured) {
+		return;
+	}
+
+	int32_t buffer_width = output->logical_geometry.width * output->scale;
+	int32_t buffer_height = output->logical_geometry.height * output->scale;
+	if (buffer_width <= 0 || buffer_height <= 0) {
+		return;
+	}
+
+	if (output_is_idle(output)) {
+		size_t pixels = 0;
+		get_idle_buffer(state, buffer_width, buffer_height, output->scale,
+			&pixels);
+	} else {
+		struct pool_buffer *buffer = get_next_buffer(state->shm,
+			output->buffers, buffer_width, buffer_height);
+		if (buffer == NULL) {
+			return;
+		}
+		output->current_buffer = buffer;
+		struct slurp_box damage;
+		render(output, &damage);
+		// nothing was shown yet, the first commit damages everything
+		render_damage_all(output);
+	}
+}
+
 static const struct wl_callback_listener output_frame_listener;
 
 static void send_frame(struct slurp_output *output) {
@@ -565,18 +875,34 @@ static void send_frame(struct slurp_output *output) {
 
 	int32_t buffer_width = output->width * output->scale;
 	int32_t buffer_height = output->height * output->scale;
+	uint64_t start = frame_stats_now();
+	size_t pixels = 0;
+	struct slurp_box damage = {0};
+
+	if (output_is_idle(output)) {
+		output->current_buffer = get_idle_buffer(state, buffer_width,
+			buffer_height, output->scale, &pixels);
+		if (output->current_buffer == NULL) {
+			return;
+		}
+		damage.width = buffer_width;
+		damage.height = buffer_height;
+		render_damage_all(output);
+	} else {
+		if (output->buffers[0].busy && output->buffers[1].busy) {
+			// the compositor still holds both, wait for a release
+			frame_stats_dropped(output);
+			return;
+		}
+		output->current_buffer = get_next_buffer(state->shm, output->buffers,
+			buffer_width, buffer_height);
+		if (output->current_buffer == NULL) {
+			return;
+		}
+		output->current_buffer->busy = true;
 
-	output->current_buffer = get_next_buffer(state->shm, output->buffers,
-		buffer_width, buffer_height);
-	if (output->current_buffer == NULL) {
-		return;
+		pixels = render(output, &damage);
 	}
-	output->current_buffer->busy = true;
-
-	cairo_identity_matrix(output->current_buffer->cairo);
-	cairo_scale(output->current_buffer->cairo, output->scale, output->scale);
-
-	render(output);
 
 	// Schedule a frame in case the output becomes dirty again
 	output->frame_callback = wl_surface_frame(output->surface);
@@ -584,10 +910,18 @@ static void send_frame(struct slurp_output *output) {
 		&output_frame_listener, output);
 
 	wl_surface_attach(output->surface, output->current_buffer->buffer, 0, 0);
-	wl_surface_damage(output->surface, 0, 0, output->width, output->height);
+	if (damage.height > 0) {
+		wl_surface_damage_buffer(output->surface, damage.x, damage.y,
+			damage.width, damage.height);
+	}
 	wl_surface_set_buffer_scale(output->surface, output->scale);
 	wl_surface_commit(output->surface);
 	output->dirty = false;
+	output->last_frame_ms = now_ms();
+
+	frame_stats_frame(output, start, pixels);
+	alloc_stats_frame(!output->first_frame_done);
+	output->first_frame_done = true;
 }
 
 static void output_frame_handle_done(void *data, struct wl_callback *callback,
@@ -597,6 +931,10 @@ static void output_frame_handle_done(void *data, struct wl_callback *callback,
 	wl_callback_destroy(callback);
 	output->frame_callback = NULL;
 
+	if (output->state->stream != NULL) {
+		stream_frame(output->state->stream, output->state);
+	}
+
 	if (output->dirty) {
 		send_frame(output);
 	}
@@ -608,7 +946,7 @@ static const struct wl_callback_listener output_frame_listener = {
 
 static void set_output_dirty(struct slurp_output *output) {
 	output->dirty = true;
-	if (output->frame_callback) {
+	if (output->frame_callback || output->surface == NULL) {
 		return;
 	}
 
@@ -618,15 +956,13 @@ static void set_output_dirty(struct slurp_output *output) {
 	wl_surface_commit(output->surface);
 }
 
+// Only the overlay surfaces have user data, see create_output_surface()
 static struct slurp_output *output_from_surface(struct slurp_state *state,
 		struct wl_surface *surface) {
-	struct slurp_output *output;
-	wl_list_for_each(output, &state->outputs, link) {
-		if (output->surface == surface) {
-			return output;
-		}
+	if (surface == NULL) {
+		return NULL;
 	}
-	return NULL;
+	return wl_surface_get_user_data(surface);
 }
 
 
@@ -654,6 +990,65 @@ static const struct zwlr_layer_surface_v1_listener layer_surface_listener = {
 	.closed = layer_surface_handle_closed,
 };
 
+static void create_output_surface(struct slurp_output *output) {
+	struct slurp_state *state = output->state;
+	output->surface = wl_compositor_create_surface(state->compositor);
+	wl_surface_set_user_data(output->surface, output);
+	// TODO: wl_surface_add_listener(output->surface, &surface_listener, output);
+
+	output->layer_surface = zwlr_layer_shell_v1_get_layer_surface(
+		state->layer_shell, output->surface, output->wl_output,
+		ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY, "selection");
+	zwlr_layer_surface_v1_add_listener(output->layer_surface,
+	  &layer_surface_listener, output);
+
+	zwlr_layer_surface_v1_set_anchor(output->layer_surface,
+		ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP |
+		ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT |
+		ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT |
+		ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM);
+	zwlr_layer_surface_v1_set_keyboard_interactivity(output->layer_surface, true);
+	zwlr_layer_surface_v1_set_exclusive_zone(output->layer_surface, -1);
+	wl_surface_commit(output->surface);
+}
+
+static void output_unmap(struct slurp_output *output) {
+	if (output->frame_callback) {
+		wl_callback_destroy(output->frame_callback);
+		output->frame_callback = NULL;
+	}
+	if (output->layer_surface) {
+		zwlr_layer_surface_v1_destroy(output->layer_surface);
+		output->layer_surface = NULL;
+	}
+	if (output->surface) {
+		wl_surface_destroy(output->surface);
+		output->surface = NULL;
+	}
+	output->configured = false;
+	// a new surface starts out empty
+	render_damage_all(output);
+}
+
+// Keeps the overlay on the given output only, for -P.
+static void choose_output(struct slurp_state *state,
+		struct slurp_output *output) {
+	state->chosen_output = output;
+
+	struct slurp_output *other;
+	wl_list_for_each(other, &state->outputs, link) {
+		if (other == output) {
+			continue;
+		}
+		output_unmap(other);
+		finish_buffer(&other->buffers[0]);
+		finish_buffer(&other->buffers[1]);
+		render_finish(other);
+	}
+
+	clip_boxes(state);
+}
+
 
 static void handle_global(void *data, struct wl_registry *registry,
 		uint32_t name, const char *interface, uint32_t version) {
@@ -668,17 +1063,24 @@ static void handle_global(void *data, struct wl_registry *registry,
 	} else if (strcmp(interface, zwlr_layer_shell_v1_interface.name) == 0) {
 		state->layer_shell = wl_registry_bind(registry, name,
 			&zwlr_layer_shell_v1_interface, 1);
-	} else if (strcmp(interface, wl_seat_interface.name) == 0) {
-		struct wl_seat *wl_seat =
-			wl_registry_bind(registry, name, &wl_seat_interface, 1);
+	} else if (strcmp(interface, wl_seat_interface.name) == 0 &&
+			!state->resolve_only) {
+		// version 5 sends wheel clicks with axis_discrete, version 8
+		// replaces them with axis_value120
+		struct wl_seat *wl_seat = wl_registry_bind(registry, name,
+			&wl_seat_interface, version < 7 ? version : 7);
 		create_seat(state, wl_seat);
 	} else if (strcmp(interface, wl_output_interface.name) == 0) {
-		struct wl_output *wl_output =
-			wl_registry_bind(registry, name, &wl_output_interface, 3);
+		// wl_output version 4 carries the output name
+		struct wl_output *wl_output = wl_registry_bind(registry, name,
+			&wl_output_interface, version < 4 ? version : 4);
 		create_output(state, wl_output);
 	} else if (strcmp(interface, zxdg_output_manager_v1_interface.name) == 0) {
 		state->xdg_output_manager = wl_registry_bind(registry, name,
 			&zxdg_output_manager_v1_interface, 2);
+	} else if (strcmp(interface, zwlr_screencopy_manager_v1_interface.name) == 0) {
+		state->screencopy_manager = wl_registry_bind(registry, name,
+			&zwlr_screencopy_manager_v1_interface, 1);
 	}
 }
 
@@ -692,7 +1094,7 @@ struct slurp_output *slurp_output_from_box(const struct slurp_box *box, struct w
 	wl_list_for_each(output, outputs, link) {
 		struct slurp_box *geometry = &output->logical_geometry;
 		// For now just use the top-left corner
-		if (in_box(geometry, box->x, box->y)) {
+		if (slurp_box_contains(geometry, box->x, box->y)) {
 			return output;
 		}
 	}
@@ -700,25 +1102,156 @@ struct slurp_output *slurp_output_from_box(const struct slurp_box *box, struct w
 }
 
 
-void slurp_add_choice_box(struct slurp_state *state, const struct slurp_box *box) {
+static void output_index_update_label(struct slurp_output *output,
+		void *data) {
+	render_update_label(output, data);
+	if (output->surface != NULL && output->configured) {
+		set_output_dirty(output);
+	}
+}
+
+static void output_index_remove_label(struct slurp_output *output,
+		void *data) {
+	render_remove_label(output, data);
+	if (output->surface != NULL && output->configured) {
+		set_output_dirty(output);
+	}
+}
+
+// Adding or removing a box gives new hints to the boxes after it, so every
+// output is redrawn.
+static void choice_boxes_reassign_hints(struct slurp_state *state) {
+	if (state->hints == NULL) {
+		return;
+	}
+	hints_invalidate(state->hints);
+	struct slurp_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		if (output->surface != NULL && output->configured) {
+			set_output_dirty(output);
+		}
+	}
+}
+
+// Appends a box to the shown ones
+static void show_choice_box(struct slurp_state *state, struct slurp_box *box) {
+	selection_record_add(state, box);
+	box->hidden = false;
+	wl_list_insert(state->boxes.prev, &box->link);
+	selection_insert_snap_edges(state, box);
+	selection_boxes_changed(state, box, 1);
+	output_index_for_each(state, box, 1, output_index_update_label, box);
+	choice_boxes_reassign_hints(state);
+}
+
+// Takes a shown box out of the list, the caller hides or frees it
+static void unlink_choice_box(struct slurp_state *state,
+		struct slurp_box *box) {
+	selection_record_remove(state, box);
+	struct slurp_box area = *box;
+	output_index_for_each(state, &area, 1, output_index_remove_label, box);
+	selection_remove_snap_edges(state, box);
+	wl_list_remove(&box->link);
+	selection_forget_box(state, box);
+	selection_boxes_changed(state, &area, 1);
+	choice_boxes_reassign_hints(state);
+}
+
+struct slurp_box *slurp_add_choice_box(struct slurp_state *state,
+		const struct slurp_box *box) {
 	struct slurp_box *b = calloc(1, sizeof(struct slurp_box));
 	if (b == NULL) {
 		fprintf(stderr, "allocation failed\n");
-		return;
+		return NULL;
 	}
 	*b = *box;
+	b->requested.x = box->x;
+	b->requested.y = box->y;
+	b->requested.width = box->width;
+	b->requested.height = box->height;
 	// copy label, so that this has ownership of its label
 	if (box->label) {
 		b->label = strdup(box->label);
 	}
-	wl_list_insert(state->boxes.prev, &b->link);
+	// added while the overlay is shown
+	if (state->boxes_clipped && !clip_box_to_outputs(state, b)) {
+		b->hidden = true;
+		wl_list_insert(state->hidden_boxes.prev, &b->link);
+		return b;
+	}
+	show_choice_box(state, b);
+	return b;
+}
+
+// Only the seats hovering and the outputs covering the old or the new
+// rectangle are updated. With -O or -P, the box is clipped again from the
+// new geometry and hidden or shown as it leaves or enters the outputs.
+void slurp_move_choice_box(struct slurp_state *state, struct slurp_box *box,
+		const struct slurp_box *geometry) {
+	struct slurp_box moved = *box;
+	moved.x = moved.requested.x = geometry->x;
+	moved.y = moved.requested.y = geometry->y;
+	moved.width = moved.requested.width = geometry->width;
+	moved.height = moved.requested.height = geometry->height;
+	bool shown = !state->boxes_clipped || clip_box_to_outputs(state, &moved);
+
+	if (box->hidden || !shown) {
+		if (box->hidden) {
+			wl_list_remove(&box->link);
+		} else {
+			unlink_choice_box(state, box);
+		}
+		*box = moved;
+		if (shown) {
+			show_choice_box(state, box);
+		} else {
+			box->hidden = true;
+			wl_list_insert(state->hidden_boxes.prev, &box->link);
+		}
+		return;
+	}
+
+	selection_record_move(state, box, &moved);
+	struct slurp_box areas[] = { *box, moved };
+	selection_remove_snap_edges(state, box);
+	*box = moved;
+	selection_insert_snap_edges(state, box);
+	selection_boxes_changed(state, areas, 2);
+	output_index_for_each(state, areas, 2, output_index_update_label, box);
+	if (state->hints != NULL) {
+		hints_move_box(state->hints, box);
+	}
+}
+
+void slurp_remove_choice_box(struct slurp_state *state, struct slurp_box *box) {
+	if (box->hidden) {
+		wl_list_remove(&box->link);
+	} else {
+		unlink_choice_box(state, box);
+	}
+	free_choice_box(state, box);
 }
 
 void slurp_state_init(struct slurp_state *state) {
 	state->error = NULL;
+	state->sway_ipc_fd = -1;
 	wl_list_init(&state->boxes);
+	wl_list_init(&state->hidden_boxes);
 	wl_list_init(&state->outputs);
 	wl_list_init(&state->seats);
+	wl_list_init(&state->idle_buffers);
+	wl_list_init(&state->keymaps);
+}
+
+void slurp_unmap(struct slurp_state *state) {
+	struct slurp_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		output_unmap(output);
+	}
+
+	// Make sure the compositor has unmapped our surfaces, this also lets it
+	// release our buffers
+	wl_display_roundtrip(state->display);
 }
 
 void slurp_destroy(struct slurp_state *state) {
@@ -730,26 +1263,178 @@ void slurp_destroy(struct slurp_state *state) {
 	wl_list_for_each_safe(seat, seat_tmp, &state->seats, link) {
 		destroy_seat(seat);
 	}
+	struct slurp_idle_buffer *idle, *idle_tmp;
+	wl_list_for_each_safe(idle, idle_tmp, &state->idle_buffers, link) {
+		wl_list_remove(&idle->link);
+		finish_buffer(&idle->buffer);
+		free(idle);
+	}
 
-	// Make sure the compositor has unmapped our surfaces by the time we exit
-	wl_display_roundtrip(state->display);
-
-	zwlr_layer_shell_v1_destroy(state->layer_shell);
+	if (state->layer_shell != NULL) {
+		zwlr_layer_shell_v1_destroy(state->layer_shell);
+	}
 	if (state->xdg_output_manager != NULL) {
 		zxdg_output_manager_v1_destroy(state->xdg_output_manager);
 	}
-	wl_compositor_destroy(state->compositor);
-	wl_shm_destroy(state->shm);
+	if (state->screencopy_manager != NULL) {
+		zwlr_screencopy_manager_v1_destroy(state->screencopy_manager);
+	}
+	if (state->compositor != NULL) {
+		wl_compositor_destroy(state->compositor);
+	}
+	if (state->shm != NULL) {
+		wl_shm_destroy(state->shm);
+	}
 	wl_registry_destroy(state->registry);
-	xkb_context_unref(state->xkb_context);
 	wl_display_disconnect(state->display);
 
+	struct slurp_keymap *keymap, *keymap_tmp;
+	wl_list_for_each_safe(keymap, keymap_tmp, &state->keymaps, link) {
+		keymap_destroy(keymap);
+	}
+	xkb_context_unref(state->xkb_context);
+
 	struct slurp_box *box, *box_tmp;
 	wl_list_for_each_safe(box, box_tmp, &state->boxes, link) {
 		wl_list_remove(&box->link);
 		free(box->label);
 		free(box);
 	}
+	wl_list_for_each_safe(box, box_tmp, &state->hidden_boxes, link) {
+		wl_list_remove(&box->link);
+		free(box->label);
+		free(box);
+	}
+	output_index_finish(state);
+	tile_pool_finish();
+	if (state->hints != NULL) {
+		hints_finish(state->hints);
+	}
+	free(state->snap_edges.x.data);
+	free(state->snap_edges.x.counts);
+	free(state->snap_edges.y.data);
+	free(state->snap_edges.y.counts);
+}
+
+// Whether the output has a buffer to give back once it's been quiet for
+// long enough. The one shown is kept, so that the next frame only redraws
+// what changed.
+static bool output_has_spare_buffer(struct slurp_output *output) {
+	if (output->current_buffer == NULL) {
+		// nothing drawn yet, the first frame may be being prepared
+		return false;
+	}
+	for (size_t i = 0; i < 2; i++) {
+		struct pool_buffer *buffer = &output->buffers[i];
+		if (buffer != output->current_buffer && buffer->data != NULL &&
+				!buffer->reclaimed && !buffer->busy) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Returns the poll timeout until the next buffer can be reclaimed
+static int reclaim_timeout(struct slurp_state *state) {
+	if (state->reclaim_delay <= 0) {
+		return -1;
+	}
+	uint64_t now = now_ms();
+	int timeout = -1;
+	struct slurp_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		if (!output_has_spare_buffer(output)) {
+			continue;
+		}
+		uint64_t deadline = output->last_frame_ms + state->reclaim_delay;
+		int left = deadline > now ? (int)(deadline - now) : 0;
+		if (timeout < 0 || left < timeout) {
+			timeout = left;
+		}
+	}
+	return timeout;
+}
+
+// The second buffer is mostly needed while frames come in quick
+// succession. Outputs that haven't drawn for a while give it back, it's
+// faulted in again by the next frame that needs it.
+static void reclaim_buffers(struct slurp_state *state) {
+	if (state->reclaim_delay <= 0) {
+		return;
+	}
+	uint64_t now = now_ms();
+	struct slurp_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		if (!output_has_spare_buffer(output) ||
+				now < output->last_frame_ms + state->reclaim_delay) {
+			continue;
+		}
+		for (size_t i = 0; i < 2; i++) {
+			if (&output->buffers[i] != output->current_buffer) {
+				reclaim_buffer(&output->buffers[i]);
+			}
+		}
+	}
+}
+
+// Like wl_display_dispatch, but also waits for the stream to become
+// writable and for control commands, and gives back the memory of unused
+// buffers.
+static bool dispatch(struct slurp_state *state) {
+	struct wl_display *display = state->display;
+	while (wl_display_prepare_read(display) != 0) {
+		if (wl_display_dispatch_pending(display) == -1) {
+			return false;
+		}
+	}
+
+	struct pollfd fds[3] = {
+		{ .fd = wl_display_get_fd(display), .events = POLLIN },
+		{ .fd = -1, .events = POLLOUT },
+		{ .fd = -1, .events = POLLIN },
+	};
+	if (wl_display_flush(display) == -1) {
+		if (errno != EAGAIN) {
+			wl_display_cancel_read(display);
+			return false;
+		}
+		fds[0].events |= POLLOUT;
+	}
+	if (state->stream != NULL && stream_wants_write(state->stream)) {
+		fds[1].fd = state->stream->fd;
+	}
+	if (state->control != NULL && !state->control->eof) {
+		fds[2].fd = state->control->fd;
+	}
+
+	while (poll(fds, 3, reclaim_timeout(state)) == -1) {
+		if (errno != EINTR) {
+			wl_display_cancel_read(display);
+			return false;
+		}
+	}
+
+	if (fds[0].revents & (POLLIN | POLLERR | POLLHUP)) {
+		if (wl_display_read_events(display) == -1) {
+			return false;
+		}
+	} else {
+		wl_display_cancel_read(display);
+	}
+	if (fds[1].revents != 0) {
+		stream_flush(state->stream);
+		// a change held back by the partial record may have no frame left
+		// to carry it
+		if (!stream_wants_write(state->stream) && state->stream->dirty) {
+			stream_frame(state->stream, state);
+		}
+	}
+	if (fds[2].revents != 0) {
+		control_read(state->control, state);
+	}
+	reclaim_buffers(state);
+
+	return wl_display_dispatch_pending(display) != -1;
 }
 
 int slurp_select(struct slurp_state *state) {
@@ -761,10 +1446,9 @@ int slurp_select(struct slurp_state *state) {
 		return EXIT_FAILURE;
 	}
 
-	if ((state->xkb_context = xkb_context_new(XKB_CONTEXT_NO_FLAGS)) == NULL) {
-		state->error = "xkb_context_new failed";
-		return EXIT_FAILURE;
-	}
+	fill_init();
+	state->selection_damage = seat_set_outputs_dirty;
+	state->boxes_damage = boxes_set_outputs_dirty;
 
 	state->registry = wl_display_get_registry(state->display);
 	wl_registry_add_listener(state->registry, &registry_listener, state);
@@ -793,65 +1477,32 @@ int slurp_select(struct slurp_state *state) {
 
 	struct slurp_output *output;
 	wl_list_for_each(output, &state->outputs, link) {
-		output->surface = wl_compositor_create_surface(state->compositor);
-		// TODO: wl_surface_add_listener(output->surface, &surface_listener, output);
-
-		output->layer_surface = zwlr_layer_shell_v1_get_layer_surface(
-			state->layer_shell, output->surface, output->wl_output,
-			ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY, "selection");
-		zwlr_layer_surface_v1_add_listener(output->layer_surface,
-		  &layer_surface_listener, output);
-
 		if (state->xdg_output_manager) {
 			output->xdg_output = zxdg_output_manager_v1_get_xdg_output(
 				state->xdg_output_manager, output->wl_output);
 			zxdg_output_v1_add_listener(output->xdg_output,
 				&xdg_output_listener, output);
-		} else {
-			// guess
-			output->logical_geometry = output->geometry;
-			output->logical_geometry.width /= output->scale;
-			output->logical_geometry.height /= output->scale;
-		}
-
-		zwlr_layer_surface_v1_set_anchor(output->layer_surface,
-			ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP |
-			ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT |
-			ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT |
-			ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM);
-		zwlr_layer_surface_v1_set_keyboard_interactivity(output->layer_surface, true);
-		zwlr_layer_surface_v1_set_exclusive_zone(output->layer_surface, -1);
-		wl_surface_commit(output->surface);
-
-		output->cursor_theme = wl_cursor_theme_load(state->cursor_theme,
-			state->cursor_size * output->scale, state->shm);
-		if (output->cursor_theme == NULL) {
-			state->error = "failed to load cursor theme";
-			return EXIT_FAILURE;
-		}
-		struct wl_cursor *cursor =
-			wl_cursor_theme_get_cursor(output->cursor_theme, "crosshair");
-		if (cursor == NULL) {
-			// Fallback
-			cursor =
-				wl_cursor_theme_get_cursor(output->cursor_theme, "left_ptr");
-		}
-		if (cursor == NULL) {
-			state->error = "failed to load cursor";
-			return EXIT_FAILURE;
-		}
-		output->cursor_image = cursor->images[0];
-	}
-	// second roundtrip for xdg-output
-	wl_display_roundtrip(state->display);
+		}
 
-	if (state->output_boxes) {
-		struct slurp_output *box_output;
-		wl_list_for_each(box_output, &state->outputs, link) {
-			slurp_add_choice_box(state, &box_output->logical_geometry);
+		// with -O, the names are needed first
+		if (state->output_names == NULL) {
+			create_output_surface(output);
 		}
 	}
 
+	// Output geometry, names and cursors are handled as their events arrive
+	// in the main loop, the first configure event gives the surface sizes.
+
+	// The window tree was requested before connecting, by now sway has
+	// most likely sent it
+	if (state->sway_ipc_fd >= 0 && !sway_ipc_read_tree(state)) {
+		return EXIT_FAILURE;
+	}
+
+	if (state->snap_threshold > 0) {
+		selection_build_snap_edges(state);
+	}
+
 	struct slurp_seat *seat;
 	wl_list_for_each(seat, &state->seats, link) {
 		seat->cursor_surface =
@@ -859,10 +1510,60 @@ int slurp_select(struct slurp_state *state) {
 	}
 
 	state->running = true;
-	while (state->running && wl_display_dispatch(state->display) != -1) {
+	while (state->running && dispatch(state)) {
 		// This space intentionally left blank
 	}
 
+	// Take the overlay off the screen right away, so that tools started
+	// after printing the result don't see it. The rest of the teardown can
+	// wait.
+	wl_list_for_each(output, &state->outputs, link) {
+		output_unmap(output);
+	}
+	wl_display_flush(state->display);
+
+	if (state->error != NULL) {
+		status = EXIT_FAILURE;
+	}
 
 	return status;
 }
+
+int slurp_resolve(struct slurp_state *state, const struct slurp_box *box) {
+	state->resolve_only = true;
+
+	state->display = wl_display_connect(NULL);
+	if (state->display == NULL) {
+		state->error = "failed to create display";
+		return EXIT_FAILURE;
+	}
+
+	state->registry = wl_display_get_registry(state->display);
+	wl_registry_add_listener(state->registry, &registry_listener, state);
+	wl_display_roundtrip(state->display);
+
+	if (wl_list_empty(&state->outputs)) {
+		state->error = "no wl_output";
+		return EXIT_FAILURE;
+	}
+
+	struct slurp_output *output;
+	wl_list_for_each(output, &state->outputs, link) {
+		if (state->xdg_output_manager) {
+			output->xdg_output = zxdg_output_manager_v1_get_xdg_output(
+				state->xdg_output_manager, output->wl_output);
+			zxdg_output_v1_add_listener(output->xdg_output,
+				&xdg_output_listener, output);
+		}
+	}
+	wl_display_roundtrip(state->display);
+
+	state->result = *box;
+	if (state->output_names != NULL &&
+			!clip_box_to_outputs(state, &state->result)) {
+		state->error = "geometry is outside of the given outputs";
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,113 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "format.h"
+#include "stream.h"
+
+bool stream_init(struct slurp_stream *stream, int fd, struct format *format) {
+	*stream = (struct slurp_stream){
+		.fd = fd,
+		.format = format,
+		.cleared = true,
+	};
+	stream->fd_flags = fcntl(fd, F_GETFL);
+	if (stream->fd_flags == -1) {
+		return false;
+	}
+	return fcntl(fd, F_SETFL, stream->fd_flags | O_NONBLOCK) != -1;
+}
+
+void stream_set_box(struct slurp_stream *stream, const struct slurp_box *box) {
+	if (!stream->cleared && box->x == stream->box.x && box->y == stream->box.y &&
+			box->width == stream->box.width &&
+			box->height == stream->box.height &&
+			box->label == stream->box.label) {
+		return;
+	}
+	stream->box = *box;
+	stream->cleared = false;
+	stream->dirty = true;
+}
+
+void stream_clear(struct slurp_stream *stream) {
+	if (stream->cleared) {
+		return;
+	}
+	stream->cleared = true;
+	stream->dirty = true;
+}
+
+void stream_flush(struct slurp_stream *stream) {
+	while (stream->pending_written < stream->pending_len) {
+		ssize_t n = write(stream->fd, stream->pending + stream->pending_written,
+			stream->pending_len - stream->pending_written);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return;
+		} else if (n < 0) {
+			// the reader went away, stop streaming
+			stream->failed = true;
+			stream->pending_len = stream->pending_written = 0;
+			return;
+		}
+		stream->pending_written += n;
+	}
+	stream->pending_len = stream->pending_written = 0;
+}
+
+// Called once per frame callback, so records are produced at most at the
+// refresh rate.
+void stream_frame(struct slurp_stream *stream, struct slurp_state *state) {
+	if (!stream->dirty || stream->failed) {
+		return;
+	}
+	// a partially written record has to be finished first
+	if (stream->pending_written > 0) {
+		return;
+	}
+	stream->dirty = false;
+
+	size_t len;
+	const char *str;
+	if (stream->cleared) {
+		str = stream->format->json ? "null\n" : "\n";
+		len = strlen(str);
+	} else {
+		str = format_render(stream->format, state, &stream->box, &len);
+	}
+	if (len > stream->pending_cap) {
+		char *pending = realloc(stream->pending, len);
+		if (pending == NULL) {
+			fprintf(stderr, "allocation failed\n");
+			return;
+		}
+		stream->pending = pending;
+		stream->pending_cap = len;
+	}
+	memcpy(stream->pending, str, len);
+	stream->pending_len = len;
+	stream_flush(stream);
+}
+
+bool stream_wants_write(const struct slurp_stream *stream) {
+	return stream->pending_written < stream->pending_len;
+}
+
+// Restores the descriptor flags and drops any unsent record, the final
+// result follows.
+void stream_finish(struct slurp_stream *stream) {
+	fcntl(stream->fd, F_SETFL, stream->fd_flags);
+	// finish the record so that the result starts on its own line
+	if (stream->pending_written > 0) {
+		stream_flush(stream);
+	}
+	free(stream->pending);
+	stream->pending = NULL;
+}
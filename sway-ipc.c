@@ -0,0 +1,300 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "json.h"
+#include "slurp.h"
+#include "sway-ipc.h"
+
+#define IPC_MAGIC "i3-ipc"
+#define IPC_GET_TREE 4
+#define IPC_HEADER_SIZE (sizeof(IPC_MAGIC) - 1 + 2 * sizeof(uint32_t))
+
+enum tree_frame_type {
+	TREE_FRAME_OTHER,
+	TREE_FRAME_NODE,
+	TREE_FRAME_RECT,
+	TREE_FRAME_NODES, // "nodes" or "floating_nodes" array
+};
+
+struct tree_frame {
+	enum tree_frame_type type;
+	// last key seen in this object
+	char key[16];
+	// node fields
+	struct slurp_box rect;
+	bool has_rect, has_pid, visible;
+	char *name;
+};
+
+// Picks the rects of visible views out of the GET_TREE reply as it is
+// parsed. Views are the nodes with a pid, as in the README recipe.
+struct tree_parser {
+	struct slurp_state *state;
+	struct tree_frame *frames;
+	size_t depth, cap;
+	bool failed;
+};
+
+static struct tree_frame *current_frame(struct tree_parser *tree) {
+	if (tree->failed || tree->depth == 0) {
+		return NULL;
+	}
+	return &tree->frames[tree->depth - 1];
+}
+
+static void push_frame(struct tree_parser *tree, enum tree_frame_type type) {
+	if (tree->failed) {
+		return;
+	}
+	if (tree->depth == tree->cap) {
+		size_t cap = tree->cap ? tree->cap * 2 : 32;
+		struct tree_frame *frames = realloc(tree->frames, cap * sizeof(*frames));
+		if (frames == NULL) {
+			fprintf(stderr, "allocation failed\n");
+			tree->failed = true;
+			return;
+		}
+		tree->frames = frames;
+		tree->cap = cap;
+	}
+	tree->frames[tree->depth++] = (struct tree_frame){ .type = type };
+}
+
+static void tree_handle_object_start(void *data) {
+	struct tree_parser *tree = data;
+	struct tree_frame *parent = current_frame(tree);
+	enum tree_frame_type type = TREE_FRAME_OTHER;
+	if (parent == NULL || parent->type == TREE_FRAME_NODES) {
+		type = TREE_FRAME_NODE;
+	} else if (parent->type == TREE_FRAME_NODE &&
+			strcmp(parent->key, "rect") == 0) {
+		type = TREE_FRAME_RECT;
+	}
+	push_frame(tree, type);
+}
+
+static void tree_handle_object_end(void *data) {
+	struct tree_parser *tree = data;
+	struct tree_frame *frame = current_frame(tree);
+	if (frame == NULL) {
+		return;
+	}
+	if (frame->type == TREE_FRAME_NODE && frame->visible &&
+			frame->has_pid && frame->has_rect) {
+		frame->rect.label = frame->name;
+		slurp_add_choice_box(tree->state, &frame->rect);
+	}
+	free(frame->name);
+	tree->depth--;
+}
+
+static void tree_handle_array_start(void *data) {
+	struct tree_parser *tree = data;
+	struct tree_frame *parent = current_frame(tree);
+	enum tree_frame_type type = TREE_FRAME_OTHER;
+	if (parent != NULL && parent->type == TREE_FRAME_NODE &&
+			(strcmp(parent->key, "nodes") == 0 ||
+			strcmp(parent->key, "floating_nodes") == 0)) {
+		type = TREE_FRAME_NODES;
+	}
+	push_frame(tree, type);
+}
+
+static void tree_handle_array_end(void *data) {
+	struct tree_parser *tree = data;
+	if (!tree->failed) {
+		tree->depth--;
+	}
+}
+
+static void tree_handle_key(void *data, const char *key) {
+	struct tree_parser *tree = data;
+	struct tree_frame *frame = current_frame(tree);
+	if (frame == NULL) {
+		return;
+	}
+	// keys longer than the buffer are never interesting
+	if (strlen(key) < sizeof(frame->key)) {
+		strcpy(frame->key, key);
+	} else {
+		frame->key[0] = '\0';
+	}
+}
+
+static void tree_handle_string(void *data, const char *value) {
+	struct tree_parser *tree = data;
+	struct tree_frame *frame = current_frame(tree);
+	if (frame != NULL &&
+			frame->type == TREE_FRAME_NODE &&
+			strcmp(frame->key, "name") == 0) {
+		free(frame->name);
+		frame->name = strdup(value);
+	}
+}
+
+static void tree_handle_number(void *data, double value) {
+	struct tree_parser *tree = data;
+	struct tree_frame *frame = current_frame(tree);
+	if (frame == NULL) {
+		return;
+	}
+	if (frame->type == TREE_FRAME_NODE && strcmp(frame->key, "pid") == 0) {
+		frame->has_pid = true;
+	} else if (frame->type == TREE_FRAME_RECT && tree->depth >= 2) {
+		struct tree_frame *node = &tree->frames[tree->depth - 2];
+		if (strcmp(frame->key, "x") == 0) {
+			node->rect.x = value;
+		} else if (strcmp(frame->key, "y") == 0) {
+			node->rect.y = value;
+		} else if (strcmp(frame->key, "width") == 0) {
+			node->rect.width = value;
+		} else if (strcmp(frame->key, "height") == 0) {
+			node->rect.height = value;
+		}
+		node->has_rect = true;
+	}
+}
+
+static void tree_handle_boolean(void *data, bool value) {
+	struct tree_parser *tree = data;
+	struct tree_frame *frame = current_frame(tree);
+	if (frame != NULL &&
+			frame->type == TREE_FRAME_NODE &&
+			strcmp(frame->key, "visible") == 0) {
+		frame->visible = value;
+	}
+}
+
+static const struct json_callbacks tree_callbacks = {
+	.object_start = tree_handle_object_start,
+	.object_end = tree_handle_object_end,
+	.array_start = tree_handle_array_start,
+	.array_end = tree_handle_array_end,
+	.key = tree_handle_key,
+	.string = tree_handle_string,
+	.number = tree_handle_number,
+	.boolean = tree_handle_boolean,
+};
+
+static bool read_full(int fd, void *buf, size_t len) {
+	char *p = buf;
+	while (len > 0) {
+		ssize_t n = read(fd, p, len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n <= 0) {
+			return false;
+		}
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+// Sends GET_TREE without waiting for the reply, so that sway builds it
+// while the Wayland connection is being set up.
+bool sway_ipc_request_tree(struct slurp_state *state) {
+	const char *path = getenv("SWAYSOCK");
+	if (path == NULL) {
+		state->error = "SWAYSOCK is not set";
+		return false;
+	}
+
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		state->error = "SWAYSOCK path is too long";
+		return false;
+	}
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		state->error = "failed to create sway IPC socket";
+		return false;
+	}
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		close(fd);
+		state->error = "failed to connect to sway IPC socket";
+		return false;
+	}
+
+	char header[IPC_HEADER_SIZE];
+	uint32_t payload_len = 0, type = IPC_GET_TREE;
+	memcpy(header, IPC_MAGIC, sizeof(IPC_MAGIC) - 1);
+	memcpy(header + sizeof(IPC_MAGIC) - 1, &payload_len, sizeof(payload_len));
+	memcpy(header + sizeof(IPC_MAGIC) - 1 + sizeof(payload_len), &type,
+		sizeof(type));
+	if (write(fd, header, sizeof(header)) != sizeof(header)) {
+		close(fd);
+		state->error = "failed to send sway IPC request";
+		return false;
+	}
+
+	state->sway_ipc_fd = fd;
+	return true;
+}
+
+// Streams the reply through the JSON parser, adding choice boxes as the
+// views are encountered.
+bool sway_ipc_read_tree(struct slurp_state *state) {
+	int fd = state->sway_ipc_fd;
+	state->sway_ipc_fd = -1;
+
+	char header[IPC_HEADER_SIZE];
+	uint32_t payload_len, type;
+	if (!read_full(fd, header, sizeof(header)) ||
+			memcmp(header, IPC_MAGIC, sizeof(IPC_MAGIC) - 1) != 0) {
+		close(fd);
+		state->error = "invalid sway IPC reply";
+		return false;
+	}
+	memcpy(&payload_len, header + sizeof(IPC_MAGIC) - 1, sizeof(payload_len));
+	memcpy(&type, header + sizeof(IPC_MAGIC) - 1 + sizeof(payload_len),
+		sizeof(type));
+	if (type != IPC_GET_TREE) {
+		close(fd);
+		state->error = "unexpected sway IPC reply";
+		return false;
+	}
+
+	struct tree_parser tree = { .state = state };
+	struct json_parser parser;
+	json_parser_init(&parser, &tree_callbacks, &tree);
+
+	bool ok = true;
+	char buf[65536];
+	while (ok && payload_len > 0) {
+		size_t len = payload_len < sizeof(buf) ? payload_len : sizeof(buf);
+		ssize_t n = read(fd, buf, len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n <= 0) {
+			ok = false;
+			break;
+		}
+		ok = json_parser_feed(&parser, buf, n);
+		payload_len -= n;
+	}
+	ok = ok && json_parser_finish(&parser) && !tree.failed;
+	close(fd);
+
+	// free names of nodes left open by a truncated reply
+	for (size_t i = 0; i < tree.depth; i++) {
+		free(tree.frames[i].name);
+	}
+	free(tree.frames);
+	json_parser_destroy(&parser);
+
+	if (!ok) {
+		state->error = "failed to parse sway IPC reply";
+	}
+	return ok;
+}
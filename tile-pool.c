@@ -0,0 +1,112 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "tile-pool.h"
+
+static struct {
+	bool started;
+	pthread_t threads[TILE_POOL_MAX_THREADS];
+	size_t threads_len;
+
+	pthread_mutex_t lock;
+	pthread_cond_t start, done;
+	uint64_t job; // bumped for every run
+	size_t pending; // workers still busy with the current job
+	bool quit;
+
+	void (*fn)(void *data, size_t i);
+	void *data;
+	size_t len;
+	size_t next; // next item to take, atomic
+} pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.start = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+};
+
+static void run_items(void) {
+	size_t i;
+	while ((i = __atomic_fetch_add(&pool.next, 1, __ATOMIC_RELAXED)) <
+			pool.len) {
+		pool.fn(pool.data, i);
+	}
+}
+
+static void *worker(void *data) {
+	uint64_t job = 0;
+	pthread_mutex_lock(&pool.lock);
+	while (true) {
+		while (!pool.quit && pool.job == job) {
+			pthread_cond_wait(&pool.start, &pool.lock);
+		}
+		if (pool.quit) {
+			break;
+		}
+		job = pool.job;
+		pthread_mutex_unlock(&pool.lock);
+
+		run_items();
+
+		pthread_mutex_lock(&pool.lock);
+		if (--pool.pending == 0) {
+			pthread_cond_signal(&pool.done);
+		}
+	}
+	pthread_mutex_unlock(&pool.lock);
+	return NULL;
+}
+
+static void start_workers(void) {
+	pool.started = true;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t n = cpus > 1 ? (size_t)cpus - 1 : 0;
+	if (n > TILE_POOL_MAX_THREADS) {
+		n = TILE_POOL_MAX_THREADS;
+	}
+	// if some fail to start, the others do the work
+	while (pool.threads_len < n && pthread_create(
+			&pool.threads[pool.threads_len], NULL, worker, NULL) == 0) {
+		pool.threads_len++;
+	}
+}
+
+void tile_pool_run(void (*fn)(void *data, size_t i), void *data, size_t len) {
+	if (!pool.started && len > 1) {
+		start_workers();
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	pool.fn = fn;
+	pool.data = data;
+	pool.len = len;
+	pool.next = 0;
+	pool.pending = pool.threads_len;
+	pool.job++;
+	pthread_cond_broadcast(&pool.start);
+	pthread_mutex_unlock(&pool.lock);
+
+	run_items();
+
+	pthread_mutex_lock(&pool.lock);
+	while (pool.pending > 0) {
+		pthread_cond_wait(&pool.done, &pool.lock);
+	}
+	pthread_mutex_unlock(&pool.lock);
+}
+
+void tile_pool_finish(void) {
+	pthread_mutex_lock(&pool.lock);
+	pool.quit = true;
+	pthread_cond_broadcast(&pool.start);
+	pthread_mutex_unlock(&pool.lock);
+	for (size_t i = 0; i < pool.threads_len; i++) {
+		pthread_join(pool.threads[i], NULL);
+	}
+	pool.threads_len = 0;
+	pool.started = false;
+	pool.quit = false;
+}